@@ -1,13 +1,26 @@
 LOCAL_PATH:= $(call my-dir)
+
+# HubSensor and what it is built from, shared with the host benchmarks
+hub_src_files := SensorBase.cpp msp430_hal.cpp HubReader.cpp \
+	SensorFifo.cpp HubClock.cpp HubControl.cpp HubCalStore.cpp \
+	HubDiag.cpp HubRecorder.cpp HubStats.cpp HubProfiler.cpp \
+	hub_sensors.c
+# the stage profiler is built in, and off until debug.sensors.msp430.profile
+hub_cflags := -DHUB_PROFILE
+
 include $(CLEAR_VARS)
 
-LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensors\"
-LOCAL_SRC_FILES := SensorBase.cpp sensors.c nusensors.cpp msp430_hal.cpp
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensors\" $(hub_cflags)
+LOCAL_SRC_FILES := sensors.c nusensors.cpp $(hub_src_files)
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+LOCAL_SRC_FILES += HubConvert.cpp.neon
+else
+LOCAL_SRC_FILES += HubConvert.cpp
+endif
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE_TAGS := optional
-LOCAL_SHARED_LIBRARIES := liblog libcutils libz
-LOCAL_C_INCLUDES := external/zlib
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdl
 LOCAL_MODULE := sensors.msm8960
 include $(BUILD_SHARED_LIBRARY)
 
@@ -32,3 +45,74 @@ LOCAL_MODULE_OWNER := google
 LOCAL_MODULE:= msp430
 LOCAL_SHARED_LIBRARIES := libcutils libc
 include $(BUILD_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags)
+LOCAL_SRC_FILES := $(hub_src_files) HubConvert.cpp \
+	bench/BenchUtil.cpp bench/decode_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(LOCAL_PATH)/bench
+LOCAL_STATIC_LIBRARIES := libmsp430_harness libcutils liblog
+LOCAL_LDLIBS := -lpthread -ldl -lrt -lm
+LOCAL_MODULE := msp430_decode_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags)
+LOCAL_SRC_FILES := sensors.c nusensors.cpp $(hub_src_files) HubConvert.cpp \
+	bench/BenchUtil.cpp bench/latency_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(LOCAL_PATH)/bench
+LOCAL_STATIC_LIBRARIES := libmsp430_harness libcutils liblog
+LOCAL_LDLIBS := -lpthread -ldl -lrt -lm
+LOCAL_MODULE := msp430_latency_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+# sensorhub.c renamed, its HAL_MODULE_INFO_SYM would clash with sensors.c's
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags) \
+	-DSENSORHUB_MODULE_SYM=sensorhub_module
+LOCAL_SRC_FILES := sensors.c nusensors.cpp $(hub_src_files) HubConvert.cpp \
+	sensorhub.c bench/BenchUtil.cpp bench/control_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(LOCAL_PATH)/bench
+LOCAL_STATIC_LIBRARIES := libmsp430_harness libcutils liblog
+LOCAL_LDLIBS := -lpthread -ldl -lrt -lm
+LOCAL_MODULE := msp430_control_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags)
+LOCAL_SRC_FILES := sensors.c nusensors.cpp $(hub_src_files) HubConvert.cpp \
+	bench/BenchUtil.cpp bench/soak_bench.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(LOCAL_PATH)/bench
+LOCAL_STATIC_LIBRARIES := libmsp430_harness libcutils liblog
+LOCAL_LDLIBS := -lpthread -ldl -lrt -lm
+LOCAL_MODULE := msp430_soak_bench
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
+
+
+# stand-ins for the hub, linked into the host tools only, never the HAL
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags)
+LOCAL_SRC_FILES := HubEmulator.cpp ReplaySensor.cpp
+LOCAL_MODULE := libmsp430_harness
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -DLOG_TAG=\"MotoSensorsBench\" $(hub_cflags)
+LOCAL_SRC_FILES := $(hub_src_files) HubConvert.cpp \
+	bench/BenchUtil.cpp bench/replay_tool.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(LOCAL_PATH)/bench
+LOCAL_STATIC_LIBRARIES := libmsp430_harness libcutils liblog
+LOCAL_LDLIBS := -lpthread -ldl -lrt -lm
+LOCAL_MODULE := msp430_replay
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
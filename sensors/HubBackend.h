@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_BACKEND_H
+#define ANDROID_HUB_BACKEND_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Stands in for the hub device nodes under HubSensor: ioctl() replaces the
+ * control node, getFd() and read() the data node. ioctl() fails like
+ * ioctl(2), with -1 and errno set. getFd() must be pollable and readable
+ * whenever read() has records to return; read() returns whole
+ * msp430_android_sensor_data records, or -1 with errno set to EAGAIN when
+ * there are none.
+ */
+class HubBackend {
+public:
+    virtual ~HubBackend() {}
+
+    virtual int ioctl(unsigned int cmd, void* arg) = 0;
+    virtual int getFd() const = 0;
+    virtual ssize_t read(void* buf, size_t len) = 0;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_BACKEND_H
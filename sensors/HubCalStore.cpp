@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cutils/log.h>
+
+#include "HubCalStore.h"
+
+/*****************************************************************************/
+
+#define CAL_MAGIC   0x4c414348  // "HCAL"
+#define CAL_VERSION 1
+
+struct cal_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t crc;
+};
+
+struct cal_record {
+    uint32_t id;
+    uint32_t len;
+    uint8_t data[HUB_CAL_MAX_LEN];
+};
+
+struct cal_file {
+    struct cal_header hdr;
+    struct cal_record rec[HUB_CAL_SLOTS];
+};
+
+static uint32_t cal_crc32(const uint8_t* p, size_t n)
+{
+    uint32_t crc = 0xffffffff;
+
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+HubCalStore::HubCalStore(const char* path)
+    : mPath(path),
+      mEventFd(-1),
+      mStopFd(-1),
+      mRunning(false),
+      mGeneration(0),
+      mWritten(0)
+{
+    memset(mSlots, 0, sizeof(mSlots));
+    memset(&mStats, 0, sizeof(mStats));
+    pthread_mutex_init(&mLock, NULL);
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mEventFd < 0, "Couldn't create cal eventfd (%s)", strerror(errno));
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mStopFd < 0, "Couldn't create cal stop eventfd (%s)", strerror(errno));
+}
+
+HubCalStore::~HubCalStore()
+{
+    stop();
+    if (mEventFd >= 0)
+        close(mEventFd);
+    if (mStopFd >= 0)
+        close(mStopFd);
+    pthread_mutex_destroy(&mLock);
+}
+
+int HubCalStore::start()
+{
+    int err;
+
+    if (mRunning)
+        return 0;
+    if (mEventFd < 0 || mStopFd < 0)
+        return -EINVAL;
+
+    err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        ALOGE("Couldn't start cal writer thread (%s)", strerror(err));
+        return -err;
+    }
+    mRunning = true;
+    return 0;
+}
+
+/*
+ * A change still settling is written before the thread exits.
+ */
+void HubCalStore::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    mRunning = false;
+}
+
+/*
+ * Replace the contents of the store with the file, returns -ENOENT if
+ * there is none and -EINVAL if it is damaged or from another version.
+ */
+int HubCalStore::load()
+{
+    struct cal_file file;
+    ssize_t n;
+    int fd;
+
+    fd = open(mPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    n = read(fd, &file, sizeof(file));
+    close(fd);
+
+    if (n < (ssize_t)sizeof(file.hdr) ||
+            file.hdr.magic != CAL_MAGIC ||
+            file.hdr.version != CAL_VERSION ||
+            file.hdr.count > HUB_CAL_SLOTS ||
+            n != (ssize_t)(sizeof(file.hdr) + file.hdr.count * sizeof(file.rec[0])) ||
+            file.hdr.crc != cal_crc32((const uint8_t*)file.rec, n - sizeof(file.hdr))) {
+        ALOGE("Ignoring damaged calibration file %s", mPath);
+        pthread_mutex_lock(&mLock);
+        mStats.errors++;
+        pthread_mutex_unlock(&mLock);
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&mLock);
+    memset(mSlots, 0, sizeof(mSlots));
+    for (uint32_t i = 0; i < file.hdr.count; i++) {
+        struct cal_record const& rec = file.rec[i];
+        if (rec.id >= HUB_CAL_SLOTS || rec.len > HUB_CAL_MAX_LEN)
+            continue;
+        mSlots[rec.id].len = rec.len;
+        memcpy(mSlots[rec.id].data, rec.data, rec.len);
+    }
+    // what was just read needs no writing back
+    mWritten = mGeneration;
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+/*
+ * Copy blob id into dst, returns -ENOENT if the store has none of exactly
+ * len bytes.
+ */
+int HubCalStore::get(int id, void* dst, size_t len) const
+{
+    int err = -ENOENT;
+
+    if (id < 0 || id >= HUB_CAL_SLOTS)
+        return -EINVAL;
+    pthread_mutex_lock(&mLock);
+    if (mSlots[id].len && mSlots[id].len == len) {
+        memcpy(dst, mSlots[id].data, len);
+        err = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+/*
+ * Update blob id and schedule a write if it changed. Never touches the
+ * filesystem unless the writer thread is not running.
+ */
+int HubCalStore::put(int id, const void* src, size_t len)
+{
+    uint64_t one = 1;
+    bool changed;
+
+    if (id < 0 || id >= HUB_CAL_SLOTS || len == 0 || len > HUB_CAL_MAX_LEN)
+        return -EINVAL;
+
+    pthread_mutex_lock(&mLock);
+    mStats.updates++;
+    changed = mSlots[id].len != len || memcmp(mSlots[id].data, src, len);
+    if (changed) {
+        mSlots[id].len = len;
+        memcpy(mSlots[id].data, src, len);
+        mGeneration++;
+    } else {
+        mStats.unchanged++;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (!changed)
+        return 0;
+    if (!mRunning)
+        return commit();
+    write(mEventFd, &one, sizeof(one));
+    return 0;
+}
+
+void HubCalStore::getStats(struct hub_cal_stats* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    *stats = mStats;
+    pthread_mutex_unlock(&mLock);
+}
+
+// Make a rename in the directory of path durable.
+static int sync_dir(const char* path)
+{
+    char dir[PATH_MAX];
+    char* slash;
+    int fd, err = 0;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (fsync(fd))
+        err = -errno;
+    close(fd);
+    return err;
+}
+
+/*
+ * Write the current generation to a temporary file and rename it over the
+ * store. Only the writer thread (or put() when there is none) calls this.
+ */
+int HubCalStore::commit()
+{
+    struct cal_file file;
+    char tmp[PATH_MAX];
+    uint32_t generation;
+    size_t size;
+    int fd, err = 0;
+
+    memset(&file, 0, sizeof(file));
+    pthread_mutex_lock(&mLock);
+    generation = mGeneration;
+    if (generation == mWritten) {
+        pthread_mutex_unlock(&mLock);
+        return 0;
+    }
+    for (int id = 0; id < HUB_CAL_SLOTS; id++) {
+        if (!mSlots[id].len)
+            continue;
+        struct cal_record& rec = file.rec[file.hdr.count++];
+        rec.id = id;
+        rec.len = mSlots[id].len;
+        memcpy(rec.data, mSlots[id].data, rec.len);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    file.hdr.magic = CAL_MAGIC;
+    file.hdr.version = CAL_VERSION;
+    size = sizeof(file.hdr) + file.hdr.count * sizeof(file.rec[0]);
+    file.hdr.crc = cal_crc32((const uint8_t*)file.rec, size - sizeof(file.hdr));
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", mPath);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        err = -errno;
+    } else {
+        if (write(fd, &file, size) != (ssize_t)size)
+            err = -EIO;
+        else if (fsync(fd))
+            err = -errno;
+        close(fd);
+        if (!err && rename(tmp, mPath))
+            err = -errno;
+        if (err)
+            unlink(tmp);
+        else
+            err = sync_dir(mPath);
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (err) {
+        ALOGE("Can't write calibration file %s (%s)", mPath, strerror(-err));
+        mStats.errors++;
+    } else {
+        mStats.writes++;
+        mStats.coalesced += generation - mWritten - 1;
+        mWritten = generation;
+    }
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+void* HubCalStore::threadLoop(void* arg)
+{
+    static_cast<HubCalStore*>(arg)->run();
+    return NULL;
+}
+
+void HubCalStore::run()
+{
+    struct pollfd fds[2];
+    uint64_t count;
+    int timeout = -1;
+    int n;
+
+    fds[0].fd = mEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        n = poll(fds, 2, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("cal writer poll() failed (%s)", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+        if (fds[0].revents & POLLIN) {
+            // (re)start the settle time, later changes join this write
+            read(mEventFd, &count, sizeof(count));
+            timeout = HUB_CAL_SETTLE_MS;
+            continue;
+        }
+        if (n == 0)
+            timeout = commit() ? HUB_CAL_RETRY_MS : -1;
+    }
+    commit();
+}
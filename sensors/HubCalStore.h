@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_CAL_STORE_H
+#define ANDROID_HUB_CAL_STORE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+#define HUB_CAL_FILE "/data/misc/msp430_cal.bin"
+
+// Calibration blobs kept in the store, one per hub algorithm that has one.
+#define HUB_CAL_MAG     0   // MSP430_IOCTL_GET/SET_MAG_CAL, MSP_MAG_CAL_SIZE bytes
+#define HUB_CAL_SLOTS   4
+#define HUB_CAL_MAX_LEN 64
+
+// Quiet time after a change before it is written, so bursts merge.
+#define HUB_CAL_SETTLE_MS 500
+// Wait before a failed write is tried again.
+#define HUB_CAL_RETRY_MS  5000
+
+struct hub_cal_stats {
+    uint32_t updates;       // put() calls
+    uint32_t unchanged;     // put() calls whose blob matched the stored one
+    uint32_t writes;        // files committed
+    uint32_t coalesced;     // changes merged into a write of a later one
+    uint32_t errors;        // failed loads and writes
+};
+
+/*
+ * Persists the hub calibration blobs in one versioned file:
+ *
+ *   header  { magic, version, slot count, crc32 of what follows }
+ *   slots   { id, length, bytes[HUB_CAL_MAX_LEN] } x slot count
+ *
+ * load() reads the whole file with a single read() and rejects it on any
+ * mismatch. put() only updates the copy in memory and wakes a writer thread
+ * that waits for HUB_CAL_SETTLE_MS of quiet, then writes a temporary file,
+ * fsync()s it, renames it over the old one and fsync()s the directory, so
+ * a crash leaves either the old or the new calibration. A failed write is
+ * retried every HUB_CAL_RETRY_MS. A put() of the blob already stored does
+ * not cause a write.
+ */
+class HubCalStore {
+public:
+            HubCalStore(const char* path);
+            ~HubCalStore();
+
+    int start();
+    void stop();
+
+    int load();
+    int get(int id, void* dst, size_t len) const;
+    int put(int id, const void* src, size_t len);
+    void getStats(struct hub_cal_stats* stats) const;
+
+private:
+    struct slot {
+        uint32_t len;           // 0 while the slot holds nothing
+        uint8_t data[HUB_CAL_MAX_LEN];
+    };
+
+    static void* threadLoop(void* arg);
+    void run();
+    int commit();
+
+    const char* mPath;
+    int mEventFd;
+    int mStopFd;
+    pthread_t mThread;
+    bool mRunning;
+
+    mutable pthread_mutex_t mLock;
+    struct slot mSlots[HUB_CAL_SLOTS];
+    uint32_t mGeneration;       // bumped by every change
+    uint32_t mWritten;          // generation last committed to the file
+
+    struct hub_cal_stats mStats;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_CAL_STORE_H
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "HubClock.h"
+
+/*****************************************************************************/
+
+// Weight left to a window minimum after each new one, about 256 windows deep.
+static const double kDecay = 1.0 - 1.0 / 256.0;
+// A crystal outside +/-500 ppm is a broken estimate rather than a slow clock.
+static const double kMaxDrift = 500e-6;
+
+HubClock::HubClock()
+{
+    memset(mLast, 0, sizeof(mLast));
+    memset(mLastHub, 0, sizeof(mLastHub));
+    reset();
+    mResets = 0;
+    mClamped = 0;
+}
+
+void HubClock::reset()
+{
+    mBase = 0;
+    mFitted = false;
+    mSw = mSx = mSy = mSxx = mSxy = 0;
+    mOffset = 0;
+    mDrift = 0;
+    mWindowCount = 0;
+    mWindowHub = 0;
+    mWindowMin = 0;
+    mSamples = 0;
+    mRawMean = mRawM2 = 0;
+    mResMean = mResM2 = 0;
+    mResets++;
+}
+
+int64_t HubClock::predictOffset(int64_t hubTs) const
+{
+    return int64_t(mOffset + mDrift * double(hubTs - mBase));
+}
+
+void HubClock::observe(int64_t hubTs, int64_t apNow)
+{
+    int64_t offset = apNow - hubTs;
+    double delta;
+
+    if (mFitted && llabs(offset - predictOffset(hubTs)) > HUB_CLOCK_STEP_NS) {
+        ALOGE("hub clock stepped by %lld ns, restarting sync",
+                (long long)(offset - predictOffset(hubTs)));
+        reset();
+    }
+
+    if (!mFitted) {
+        // until the first window completes, the best offset seen so far
+        mBase = hubTs;
+        mOffset = offset;
+        mFitted = true;
+    } else if (mSw == 0 && offset < mOffset) {
+        mOffset = offset;
+    }
+
+    mSamples++;
+    delta = offset - mRawMean;
+    mRawMean += delta / mSamples;
+    mRawM2 += delta * (offset - mRawMean);
+    double residual = double(offset - predictOffset(hubTs));
+    delta = residual - mResMean;
+    mResMean += delta / mSamples;
+    mResM2 += delta * (residual - mResMean);
+
+    if (mWindowCount == 0 || offset < mWindowMin) {
+        mWindowMin = offset;
+        mWindowHub = hubTs;
+    }
+    if (++mWindowCount < HUB_CLOCK_WINDOW)
+        return;
+    mWindowCount = 0;
+
+    // fit offset = a + b * (hub - base), y kept relative to the last
+    // estimate so the sums stay well conditioned
+    double x = double(mWindowHub - mBase);
+    double y = double(mWindowMin) - mOffset;
+    double a, b, det;
+
+    mSw = mSw * kDecay + 1;
+    mSx = mSx * kDecay + x;
+    mSy = mSy * kDecay + y;
+    mSxx = mSxx * kDecay + x * x;
+    mSxy = mSxy * kDecay + x * y;
+
+    det = mSw * mSxx - mSx * mSx;
+    if (det > 1e-9 * mSw * mSxx) {
+        b = (mSw * mSxy - mSx * mSy) / det;
+        if (b > kMaxDrift)
+            b = kMaxDrift;
+        else if (b < -kMaxDrift)
+            b = -kMaxDrift;
+    } else {
+        b = 0;
+    }
+    a = (mSy - b * mSx) / mSw;
+
+    // re-express the sums relative to the new intercept
+    mSy -= a * mSw;
+    mSxy -= a * mSx;
+    mOffset += a;
+    mDrift = b;
+}
+
+int64_t HubClock::toMonotonic(int handle, int64_t hubTs, int64_t apNow)
+{
+    int64_t ts;
+
+    if (!mFitted)
+        return hubTs;
+
+    ts = hubTs + predictOffset(hubTs);
+    // an event cannot have happened after it was read
+    if (ts > apNow)
+        ts = apNow;
+    if (handle >= 0 && handle < SENSORS_NUM_HANDLES) {
+        if (ts < mLast[handle]) {
+            // the fit moved back: keep the hub's own spacing from the last
+            // event, still no later than the read and never backwards
+            ts = mLast[handle] + (hubTs > mLastHub[handle] ? hubTs - mLastHub[handle] : 0);
+            if (ts > apNow)
+                ts = apNow;
+            if (ts < mLast[handle])
+                ts = mLast[handle];
+            mClamped++;
+        }
+        mLast[handle] = ts;
+        mLastHub[handle] = hubTs;
+    }
+    return ts;
+}
+
+void HubClock::getStats(struct hub_clock_stats* stats) const
+{
+    stats->samples = mSamples;
+    stats->resets = mResets;
+    stats->clamped = mClamped;
+    stats->offset_ns = mFitted ? int64_t(mOffset) : 0;
+    stats->drift_ppb = int32_t(mDrift * 1e9);
+    stats->raw_jitter_ns = mSamples > 1 ? uint32_t(sqrt(mRawM2 / (mSamples - 1))) : 0;
+    stats->residual_jitter_ns = mSamples > 1 ? uint32_t(sqrt(mResM2 / (mSamples - 1))) : 0;
+}
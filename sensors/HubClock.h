@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_CLOCK_H
+#define ANDROID_HUB_CLOCK_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+// Correlation samples folded into one minimum before it enters the fit.
+#define HUB_CLOCK_WINDOW 16
+// Offset error beyond which the hub clock is taken to have been re-based.
+#define HUB_CLOCK_STEP_NS 1000000000LL
+
+struct hub_clock_stats {
+    uint32_t samples;           // (hub, AP) pairs observed since the last reset
+    uint32_t resets;            // fits restarted after a hub reset or clock step
+    uint32_t clamped;           // timestamps moved to stay monotonic
+    int64_t offset_ns;          // current AP - hub offset
+    int32_t drift_ppb;          // hub clock rate error
+    uint32_t raw_jitter_ns;     // stddev of AP arrival - hub timestamp
+    uint32_t residual_jitter_ns; // stddev of AP arrival - corrected timestamp
+};
+
+/*
+ * Maps hub timestamps onto CLOCK_MONOTONIC. Each read contributes one
+ * (hub timestamp, AP arrival time) pair. Arrival is late by a variable
+ * delivery latency, so the smallest offset of every HUB_CLOCK_WINDOW pairs
+ * is taken as the true one. Those minima feed an exponentially weighted
+ * least squares fit of offset against hub time, which gives both offset and
+ * drift. Corrected timestamps never run ahead of the arrival time and never
+ * go backwards per handle; when the fit would step back, an event is placed
+ * after the previous one by the hub's own interval between them.
+ */
+class HubClock {
+public:
+            HubClock();
+
+    void reset();
+    void observe(int64_t hubTs, int64_t apNow);
+    int64_t toMonotonic(int handle, int64_t hubTs, int64_t apNow);
+    void getStats(struct hub_clock_stats* stats) const;
+
+private:
+    int64_t predictOffset(int64_t hubTs) const;
+
+    int64_t mBase;              // hub time the fit is relative to
+    bool mFitted;
+    double mSw, mSx, mSy, mSxx, mSxy;
+    double mOffset;             // fitted offset at mBase, ns
+    double mDrift;              // fitted d(offset)/d(hub time)
+
+    int mWindowCount;
+    int64_t mWindowHub;
+    int64_t mWindowMin;
+
+    int64_t mLast[SENSORS_NUM_HANDLES];
+    int64_t mLastHub[SENSORS_NUM_HANDLES];
+
+    uint32_t mSamples;
+    uint32_t mResets;
+    uint32_t mClamped;
+    double mRawMean, mRawM2;
+    double mResMean, mResM2;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_CLOCK_H
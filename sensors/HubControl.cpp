@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "HubControl.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+#define QUEUE_MASK (HUB_CONTROL_QUEUE_SIZE - 1)
+
+struct hub_completion {
+    volatile int32_t done;
+    int status;
+};
+
+HubControl::HubControl(handler_t handler, void* cookie)
+    : mHandler(handler),
+      mCookie(cookie),
+      mEventFd(-1),
+      mStopFd(-1),
+      mRunning(false),
+      mDeadline(0),
+      mEnqueuePos(0),
+      mDequeuePos(0),
+      mFailed(0),
+      mPosted(0),
+      mExecuted(0),
+      mFull(0),
+      mRefused(0),
+      mWakeup(0)
+{
+    pthread_mutexattr_t attr;
+
+    for (int i = 0; i < HUB_CONTROL_QUEUE_SIZE; i++)
+        mQueue[i].seq = i;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mExecLock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&mDoneLock, NULL);
+    pthread_cond_init(&mDoneCond, NULL);
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mEventFd < 0, "Couldn't create control eventfd (%s)", strerror(errno));
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mStopFd < 0, "Couldn't create control stop eventfd (%s)", strerror(errno));
+}
+
+HubControl::~HubControl()
+{
+    stop();
+    if (mEventFd >= 0)
+        close(mEventFd);
+    if (mStopFd >= 0)
+        close(mStopFd);
+    pthread_cond_destroy(&mDoneCond);
+    pthread_mutex_destroy(&mDoneLock);
+    pthread_mutex_destroy(&mExecLock);
+}
+
+int HubControl::start()
+{
+    int err;
+
+    if (mRunning)
+        return 0;
+    if (mEventFd < 0 || mStopFd < 0)
+        return -EINVAL;
+
+    err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        ALOGE("Couldn't start hub control thread (%s)", strerror(err));
+        return -err;
+    }
+    mRunning = true;
+    return 0;
+}
+
+/*
+ * Commands still queued are run before the thread exits, so nothing posted
+ * before stop() is lost.
+ */
+void HubControl::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    mRunning = false;
+}
+
+bool HubControl::push(struct hub_command const& cmd)
+{
+    int32_t pos = android_atomic_acquire_load(&mEnqueuePos);
+    struct slot* s;
+
+    for (;;) {
+        s = &mQueue[pos & QUEUE_MASK];
+        int32_t dif = android_atomic_acquire_load(&s->seq) - pos;
+        if (dif == 0) {
+            if (android_atomic_release_cas(pos, pos + 1, &mEnqueuePos) == 0)
+                break;
+        } else if (dif < 0) {
+            // the consumer has not released this slot yet: full
+            android_atomic_inc(&mFull);
+            return false;
+        }
+        pos = android_atomic_acquire_load(&mEnqueuePos);
+    }
+
+    s->cmd = cmd;
+    android_atomic_release_store(pos + 1, &s->seq);
+    android_atomic_inc(&mPosted);
+    return true;
+}
+
+bool HubControl::pop(struct hub_command* cmd)
+{
+    struct slot* s = &mQueue[mDequeuePos & QUEUE_MASK];
+
+    if (android_atomic_acquire_load(&s->seq) != mDequeuePos + 1)
+        return false;
+    *cmd = s->cmd;
+    android_atomic_release_store(mDequeuePos + HUB_CONTROL_QUEUE_SIZE, &s->seq);
+    mDequeuePos++;
+    return true;
+}
+
+int HubControl::execute(struct hub_command const& cmd)
+{
+    int status = mHandler(mCookie, cmd);
+
+    android_atomic_inc(&mExecuted);
+    if (cmd.done) {
+        pthread_mutex_lock(&mDoneLock);
+        cmd.done->status = status;
+        android_atomic_release_store(1, &cmd.done->done);
+        pthread_cond_broadcast(&mDoneCond);
+        pthread_mutex_unlock(&mDoneLock);
+    }
+    return status;
+}
+
+// Run the queued commands, then an owed wakeup. mExecLock held.
+void HubControl::drain()
+{
+    const struct hub_command wakeup = { HUB_CONTROL_WAKEUP, 0, 0, NULL };
+    struct hub_command cmd;
+
+    while (pop(&cmd))
+        execute(cmd);
+    if (android_atomic_release_cas(1, 0, &mWakeup) == 0)
+        execute(wakeup);
+}
+
+bool HubControl::runsInline() const
+{
+    return !mRunning || android_atomic_acquire_load(&mFailed);
+}
+
+/*
+ * Run cmd on the calling thread, after what the control thread left queued.
+ * Only the handler runs under mExecLock, never under mDoneLock, so it may
+ * post or wake up from within.
+ */
+int HubControl::runInline(struct hub_command const& cmd)
+{
+    int status;
+
+    pthread_mutex_lock(&mExecLock);
+    drain();
+    status = execute(cmd);
+    pthread_mutex_unlock(&mExecLock);
+    return status;
+}
+
+void HubControl::runQueued()
+{
+    pthread_mutex_lock(&mExecLock);
+    drain();
+    pthread_mutex_unlock(&mExecLock);
+}
+
+/*
+ * Queue a command and return without waiting for it. Safe from any thread,
+ * never blocks; returns -EAGAIN if the queue is full.
+ */
+int HubControl::post(int op, int32_t handle, int64_t arg)
+{
+    struct hub_command cmd = { op, handle, arg, NULL };
+    uint64_t one = 1;
+
+    if (runsInline()) {
+        runInline(cmd);
+        return 0;
+    }
+    if (!push(cmd)) {
+        android_atomic_inc(&mRefused);
+        return -EAGAIN;
+    }
+    write(mEventFd, &one, sizeof(one));
+    // the thread may have quit without seeing it
+    if (android_atomic_acquire_load(&mFailed))
+        runQueued();
+    return 0;
+}
+
+/*
+ * Have the handler called with HUB_CONTROL_WAKEUP once the commands queued
+ * so far have run. Safe from any thread, never blocks nor fails: wakeups
+ * asked for before the handler gets to run are merged into one.
+ */
+void HubControl::wakeup()
+{
+    const struct hub_command wakeup = { HUB_CONTROL_WAKEUP, 0, 0, NULL };
+    uint64_t one = 1;
+
+    if (runsInline()) {
+        runInline(wakeup);
+        return;
+    }
+    android_atomic_release_store(1, &mWakeup);
+    write(mEventFd, &one, sizeof(one));
+    if (android_atomic_acquire_load(&mFailed))
+        runQueued();
+}
+
+/*
+ * Queue a command and wait until the control thread has run it, returns
+ * the handler's status. Run inline when called from the control thread
+ * itself or when it is not running. Should the thread quit meanwhile, the
+ * caller runs the queue itself.
+ */
+int HubControl::call(int op, int32_t handle, int64_t arg)
+{
+    struct hub_completion done = { 0, 0 };
+    struct hub_command cmd = { op, handle, arg, NULL };
+    uint64_t one = 1;
+
+    if (runsInline())
+        return runInline(cmd);
+    if (pthread_equal(pthread_self(), mThread))
+        return execute(cmd);
+    cmd.done = &done;
+
+    while (!push(cmd)) {
+        if (android_atomic_acquire_load(&mFailed))
+            runQueued();
+        sched_yield();
+    }
+    write(mEventFd, &one, sizeof(one));
+
+    pthread_mutex_lock(&mDoneLock);
+    while (!android_atomic_acquire_load(&done.done)) {
+        if (android_atomic_acquire_load(&mFailed)) {
+            // the thread quit, its broadcast woke us up
+            pthread_mutex_unlock(&mDoneLock);
+            runQueued();
+            pthread_mutex_lock(&mDoneLock);
+            continue;
+        }
+        pthread_cond_wait(&mDoneCond, &mDoneLock);
+    }
+    pthread_mutex_unlock(&mDoneLock);
+    return done.status;
+}
+
+/*
+ * Have the handler called with HUB_CONTROL_TIMER in ms milliseconds,
+ * replacing any earlier deadline; ms < 0 disarms. Only valid on the control
+ * thread, returns -ENOSYS when there is none so the caller acts right away.
+ */
+int HubControl::setTimer(int ms)
+{
+    if (runsInline())
+        return -ENOSYS;
+    mDeadline = ms < 0 ? 0 : SensorBase::getTimestamp() + ms * 1000000LL;
+    return 0;
+}
+
+int HubControl::timeout() const
+{
+    int64_t left;
+
+    if (!mDeadline)
+        return -1;
+    left = mDeadline - SensorBase::getTimestamp();
+    return left > 0 ? int((left + 999999) / 1000000) : 0;
+}
+
+void HubControl::getStats(struct hub_control_stats* stats) const
+{
+    stats->posted = android_atomic_acquire_load(&mPosted);
+    stats->executed = android_atomic_acquire_load(&mExecuted);
+    stats->full = android_atomic_acquire_load(&mFull);
+    stats->refused = android_atomic_acquire_load(&mRefused);
+}
+
+void* HubControl::threadLoop(void* arg)
+{
+    static_cast<HubControl*>(arg)->run();
+    return NULL;
+}
+
+void HubControl::run()
+{
+    const struct hub_command timer = { HUB_CONTROL_TIMER, 0, 0, NULL };
+    struct pollfd fds[2];
+    uint64_t count;
+
+    fds[0].fd = mEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, timeout()) < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("control poll() failed (%s), commands run inline", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+            read(mEventFd, &count, sizeof(count));
+        pthread_mutex_lock(&mExecLock);
+        drain();
+        // a deadline still pending at stop() is run early rather than lost
+        if (mDeadline && (timeout() == 0 || (fds[1].revents & POLLIN))) {
+            mDeadline = 0;
+            execute(timer);
+        }
+        pthread_mutex_unlock(&mExecLock);
+        if (fds[1].revents & POLLIN)
+            return;
+    }
+
+    // Callers run their commands themselves from now on. The timer can't
+    // be kept, it fires now; those waiting in call() wake up to run theirs.
+    android_atomic_release_store(1, &mFailed);
+    pthread_mutex_lock(&mExecLock);
+    drain();
+    if (mDeadline) {
+        mDeadline = 0;
+        execute(timer);
+    }
+    pthread_mutex_unlock(&mExecLock);
+    pthread_mutex_lock(&mDoneLock);
+    pthread_cond_broadcast(&mDoneCond);
+    pthread_mutex_unlock(&mDoneLock);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_CONTROL_H
+#define ANDROID_HUB_CONTROL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+// Commands in flight between the callers and the control thread, must be a
+// power of 2.
+#define HUB_CONTROL_QUEUE_SIZE 64
+
+// Op the handler receives when the timer armed with setTimer() expires.
+#define HUB_CONTROL_TIMER (-1)
+// Op the handler receives after wakeup(), once the queue has been drained.
+#define HUB_CONTROL_WAKEUP (-2)
+
+struct hub_completion;
+
+struct hub_command {
+    int op;                         // defined by the handler
+    int32_t handle;
+    int64_t arg;
+    struct hub_completion* done;    // NULL when nobody waits for the result
+};
+
+struct hub_control_stats {
+    uint32_t posted;        // commands queued
+    uint32_t executed;      // commands run by the control thread
+    uint32_t full;          // post() attempts that found the queue full
+    uint32_t refused;       // posted commands lost to a full queue, left to the caller
+};
+
+/*
+ * Runs the commands that touch the hub (ioctls, calibration files, dumps)
+ * on one dedicated thread, so the event delivery thread never blocks on
+ * them and the hub state they change has a single writer.
+ *
+ * Any thread can queue a command: the queue is a bounded multi-producer /
+ * single-consumer ring where producers claim a slot with a CAS and publish
+ * it through a per-slot sequence number. post() returns immediately,
+ * call() waits for the command to have run and returns its status.
+ *
+ * The handler can also arm a one-shot timer from the control thread, which
+ * comes back to it as a HUB_CONTROL_TIMER command. A caller whose post()
+ * was refused keeps the work aside and calls wakeup(), which never fails;
+ * the handler picks it up on HUB_CONTROL_WAKEUP.
+ *
+ * Before start(), or once the thread has quit on an error, commands run on
+ * the caller's thread instead, along with whatever was left queued. The
+ * handler is never run twice at once and may post, call or wake up from
+ * within itself.
+ */
+class HubControl {
+public:
+    typedef int (*handler_t)(void* cookie, struct hub_command const& cmd);
+
+            HubControl(handler_t handler, void* cookie);
+            ~HubControl();
+
+    int start();
+    void stop();
+
+    int post(int op, int32_t handle, int64_t arg);
+    int call(int op, int32_t handle, int64_t arg);
+    int setTimer(int ms);
+    void wakeup();
+
+    void getStats(struct hub_control_stats* stats) const;
+
+private:
+    struct slot {
+        volatile int32_t seq;
+        struct hub_command cmd;
+    };
+
+    static void* threadLoop(void* arg);
+    void run();
+    bool push(struct hub_command const& cmd);
+    bool pop(struct hub_command* cmd);
+    int execute(struct hub_command const& cmd);
+    void drain();
+    bool runsInline() const;
+    int runInline(struct hub_command const& cmd);
+    void runQueued();
+    int timeout() const;
+
+    handler_t mHandler;
+    void* mCookie;
+    int mEventFd;
+    int mStopFd;
+    pthread_t mThread;
+    bool mRunning;
+    int64_t mDeadline;              // CLOCK_MONOTONIC ns, 0 when disarmed
+
+    struct slot mQueue[HUB_CONTROL_QUEUE_SIZE];
+    volatile int32_t mEnqueuePos;   // shared by all producers
+    int32_t mDequeuePos;            // whoever runs the handler only
+
+    pthread_mutex_t mExecLock;      // held to run the handler, recursive
+    pthread_mutex_t mDoneLock;
+    pthread_cond_t mDoneCond;
+    volatile int32_t mFailed;       // 1 once the thread has quit on an error
+
+    volatile int32_t mPosted;
+    volatile int32_t mExecuted;
+    volatile int32_t mFull;
+    volatile int32_t mRefused;
+    volatile int32_t mWakeup;       // 1 while a HUB_CONTROL_WAKEUP is owed
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_CONTROL_H
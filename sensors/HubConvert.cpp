@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HUB_CONVERT_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define HUB_CONVERT_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HUB_CONVERT_SSE2
+#endif
+
+#include "HubConvert.h"
+
+/*****************************************************************************/
+
+void hub_convert_s16(const int16_t* src, const float* scale, float* dst, int n)
+{
+    int i = 0;
+
+#if defined(HUB_CONVERT_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t raw = vld1q_s16(src + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(raw)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(raw)));
+        vst1q_f32(dst + i, vmulq_f32(lo, vld1q_f32(scale + i)));
+        vst1q_f32(dst + i + 4, vmulq_f32(hi, vld1q_f32(scale + i + 4)));
+    }
+#elif defined(HUB_CONVERT_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i raw = _mm_loadu_si128((const __m128i*)(src + i));
+        __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(raw));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(v, _mm256_loadu_ps(scale + i)));
+    }
+#elif defined(HUB_CONVERT_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i raw = _mm_loadu_si128((const __m128i*)(src + i));
+        // sign extend by placing each sample in the top half and shifting
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_loadu_ps(scale + i)));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), _mm_loadu_ps(scale + i + 4)));
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = src[i] * scale[i];
+}
+
+const char* hub_convert_kernel(void)
+{
+#if defined(HUB_CONVERT_NEON)
+    return "neon";
+#elif defined(HUB_CONVERT_AVX2)
+    return "avx2";
+#elif defined(HUB_CONVERT_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
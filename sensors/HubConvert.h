@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_CONVERT_H
+#define ANDROID_HUB_CONVERT_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/*****************************************************************************/
+
+/*
+ * dst[i] = src[i] * scale[i] for n lanes. The samples are taken in host
+ * order, as MSP16TOH() does today. Uses NEON on ARM and SSE2/AVX2 on x86
+ * when the compiler targets them, with a scalar fallback; all variants give
+ * results bit-identical to the scalar multiply.
+ */
+void hub_convert_s16(const int16_t* src, const float* scale, float* dst, int n);
+
+/* Name of the kernel compiled in, for benchmarks and logs. */
+const char* hub_convert_kernel(void);
+
+/*****************************************************************************/
+
+__END_DECLS
+
+#endif  // ANDROID_HUB_CONVERT_H
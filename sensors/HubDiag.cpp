@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "HubDiag.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+#define ZLIB_LIBRARY "libz.so"
+
+HubDiag::HubDiag()
+    : mWriter(writeHandler, this),
+      mRunning(false),
+      mZlib(NULL),
+      mZlibTried(false),
+      mGzdopen(NULL),
+      mGzwrite(NULL),
+      mGzclose(NULL),
+      mLastTime(0),
+      mSameTime(0),
+      mReported(0),
+      mLimited(0),
+      mDropped(0),
+      mWritten(0),
+      mErrors(0)
+{
+    memset((void*)mLast, 0, sizeof(mLast));
+}
+
+HubDiag::~HubDiag()
+{
+    stop();
+    if (mZlib)
+        dlclose(mZlib);
+}
+
+int HubDiag::start()
+{
+    int err = mWriter.start();
+
+    mRunning = !err;
+    return err;
+}
+
+/*
+ * Entries already queued are written before this returns.
+ */
+void HubDiag::stop()
+{
+    mWriter.stop();
+    mRunning = false;
+}
+
+/*
+ * Queue a dropbox entry for (kind, id) unless one was queued less than
+ * HUB_DIAG_INTERVAL_S ago. Returns whether it was queued.
+ */
+bool HubDiag::report(int kind, int id)
+{
+    int32_t last, stamp;
+
+    android_atomic_inc(&mReported);
+    if (!mRunning || kind < 0 || kind >= HUB_DIAG_KINDS)
+        return false;
+    id &= HUB_DIAG_IDS - 1;
+
+    stamp = int32_t(SensorBase::getTimestamp() / 1000000000LL) + 1;
+    last = android_atomic_acquire_load(&mLast[kind][id]);
+    if ((last && stamp - last < HUB_DIAG_INTERVAL_S) ||
+            android_atomic_release_cas(last, stamp, &mLast[kind][id])) {
+        android_atomic_inc(&mLimited);
+        return false;
+    }
+
+    if (mWriter.post(kind, id, time(NULL))) {
+        // nothing was queued, let the next one through unless it got there first
+        android_atomic_release_cas(stamp, last, &mLast[kind][id]);
+        android_atomic_inc(&mDropped);
+        return false;
+    }
+    return true;
+}
+
+void HubDiag::getStats(struct hub_diag_stats* stats) const
+{
+    stats->reported = android_atomic_acquire_load(&mReported);
+    stats->limited = android_atomic_acquire_load(&mLimited);
+    stats->dropped = android_atomic_acquire_load(&mDropped);
+    stats->written = android_atomic_acquire_load(&mWritten);
+    stats->errors = android_atomic_acquire_load(&mErrors);
+}
+
+int HubDiag::writeHandler(void* cookie, struct hub_command const& cmd)
+{
+    HubDiag* const self = static_cast<HubDiag*>(cookie);
+    int err = self->writeEntry(cmd.op, cmd.handle, cmd.arg);
+
+    android_atomic_inc(err ? &self->mErrors : &self->mWritten);
+    return err;
+}
+
+/*
+ * Resolve the gz* entry points the first time an entry is written, so the
+ * HAL does not map zlib until it has something to compress.
+ */
+bool HubDiag::loadZlib()
+{
+    if (mZlibTried)
+        return mZlib != NULL;
+    mZlibTried = true;
+
+    mZlib = dlopen(ZLIB_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    if (!mZlib) {
+        ALOGE("Can't load %s, dropbox entries stay uncompressed", ZLIB_LIBRARY);
+        return false;
+    }
+    *(void**)&mGzdopen = dlsym(mZlib, "gzdopen");
+    *(void**)&mGzwrite = dlsym(mZlib, "gzwrite");
+    *(void**)&mGzclose = dlsym(mZlib, "gzclose");
+    if (!mGzdopen || !mGzwrite || !mGzclose) {
+        dlclose(mZlib);
+        mZlib = NULL;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Runs on the writer thread.
+ */
+int HubDiag::writeEntry(int kind, int id, int64_t when)
+{
+    char timeBuf[32];
+    char buffer[128];
+    char tmp[192];
+    char path[192];
+    time_t t = when;
+    struct tm tm;
+    int flags = DROPBOX_FLAG_TEXT;
+    int fd, len, err = 0;
+
+    if (!localtime_r(&t, &tm))
+        return -EINVAL;
+    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", &tm);
+    len = snprintf(buffer, sizeof(buffer), "timestamp:%s\n%s:%02d\n", timeBuf,
+            kind == HUB_DIAG_RESET ? "reason" : "type", id);
+
+    if (loadZlib())
+        flags |= DROPBOX_FLAG_GZIP;
+    // several reasons can fire within a second, keep their names apart
+    if (t == mLastTime) {
+        size_t n = strlen(timeBuf);
+        snprintf(timeBuf + n, sizeof(timeBuf) - n, ".%d", ++mSameTime);
+    } else {
+        mLastTime = t;
+        mSameTime = 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s:%d:%u-%s",
+            DROPBOX_DIR, DROPBOX_TAG, flags, getpid(), timeBuf);
+    // the dropbox service must never see a partial entry
+    snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", DROPBOX_DIR, DROPBOX_TAG);
+    ALOGD("msp430 - dumping to dropbox file[%s]...\n", path);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ALOGE("ERROR! unable to open dropbox file[errno:%d(%s)]\n", errno, strerror(errno));
+        return -errno;
+    }
+
+    if (flags & DROPBOX_FLAG_GZIP) {
+        // gzclose() closes the descriptor it was given, keep ours for fsync
+        int gzfd = dup(fd);
+        void* gz = gzfd >= 0 ? mGzdopen(gzfd, "wb") : NULL;
+        if (!gz) {
+            if (gzfd >= 0)
+                close(gzfd);
+            err = -EIO;
+        } else {
+            if (mGzwrite(gz, buffer, len) != len)
+                err = -EIO;
+            if (mGzclose(gz))
+                err = -EIO;
+        }
+    } else if (write(fd, buffer, len) != len) {
+        err = -EIO;
+    }
+
+    // only this file, unlike sync() which flushed the whole device
+    if (!err && fsync(fd))
+        err = -errno;
+    close(fd);
+    if (!err && rename(tmp, path))
+        err = -errno;
+    if (err) {
+        ALOGE("Can't write dropbox file %s (%s)", path, strerror(-err));
+        unlink(tmp);
+    }
+    return err;
+}
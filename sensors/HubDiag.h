@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_DIAG_H
+#define ANDROID_HUB_DIAG_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "HubControl.h"
+
+/*****************************************************************************/
+
+#define DROPBOX_DIR "/data/system/dropbox-add"
+#define DROPBOX_TAG "SENSOR_HUB"
+#define DROPBOX_FLAG_TEXT        2
+#define DROPBOX_FLAG_GZIP        4
+
+#define HUB_DIAG_PROPERTY "ro.sensors.msp430.diag"
+
+// What a report is about; the id is a hub reset reason or a DT_* type.
+#define HUB_DIAG_RESET      0
+#define HUB_DIAG_RECORD     1
+#define HUB_DIAG_KINDS      2
+#define HUB_DIAG_IDS        256
+
+// Minimum time between two entries for the same kind and id.
+#define HUB_DIAG_INTERVAL_S (10 * 60)
+
+struct hub_diag_stats {
+    uint32_t reported;      // report() calls
+    uint32_t limited;       // reports dropped by the per-reason rate limit
+    uint32_t dropped;       // reports dropped because the queue was full
+    uint32_t written;       // dropbox entries committed
+    uint32_t errors;        // entries that could not be written
+};
+
+/*
+ * Writes dropbox entries for hub events worth a bug report. report() is
+ * cheap and never blocks, so it can be called from the event path: it
+ * applies the rate limit with one CAS and queues the rest for a writer
+ * thread. The writer builds the entry under a hidden name, fsync()s that
+ * file alone and renames it into DROPBOX_DIR. zlib is only loaded with the
+ * first entry; without it entries are written as plain text.
+ */
+class HubDiag {
+public:
+            HubDiag();
+            ~HubDiag();
+
+    int start();
+    void stop();
+
+    bool report(int kind, int id);
+    void getStats(struct hub_diag_stats* stats) const;
+
+private:
+    static int writeHandler(void* cookie, struct hub_command const& cmd);
+    int writeEntry(int kind, int id, int64_t when);
+    bool loadZlib();
+
+    HubControl mWriter;
+    bool mRunning;
+    // CLOCK_MONOTONIC second of the last accepted report, plus one
+    volatile int32_t mLast[HUB_DIAG_KINDS][HUB_DIAG_IDS];
+
+    void* mZlib;
+    bool mZlibTried;
+    void* (*mGzdopen)(int fd, const char* mode);
+    int (*mGzwrite)(void* file, const void* buf, unsigned len);
+    int (*mGzclose)(void* file);
+    int64_t mLastTime;          // wall clock second of the last entry
+    int mSameTime;              // entries already named after that second
+
+    volatile int32_t mReported;
+    volatile int32_t mLimited;
+    volatile int32_t mDropped;
+    volatile int32_t mWritten;
+    volatile int32_t mErrors;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_DIAG_H
@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "HubEmulator.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+#define ALGO_CONFIDENCE 100
+
+// SET_ALGOS bit of each MSP_IDX_* algo.
+static const uint16_t emu_algo_bits[MSP_NUM_ALGOS] = {
+    M_ALGO_MODALITY, M_ALGO_ORIENTATION, M_ALGO_STOWED,
+    M_ALGO_ACCUM_MODALITY, M_ALGO_ACCUM_MVMT,
+};
+
+static int sensorhub_ioctl(void* cookie, unsigned int cmd, void* arg)
+{
+    return static_cast<HubEmulator*>(cookie)->ioctl(cmd, arg);
+}
+
+static ssize_t sensorhub_read(void* cookie, void* buf, size_t len)
+{
+    return static_cast<HubEmulator*>(cookie)->readMotion(buf, len);
+}
+
+static void arm_timer(int fd, int64_t when)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    // 0 disarms, an absolute time in the past expires at once
+    its.it_value.tv_sec = when / 1000000000LL;
+    its.it_value.tv_nsec = when % 1000000000LL;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+HubEmulator::HubEmulator()
+    : mIoctlUs(0),
+      mDataTimer(-1),
+      mMotionTimer(-1),
+      mEnabled(0),
+      mWake(0),
+      mAlgos(0),
+      mMotionDur(0),
+      mZrMotionDur(0),
+      mHead(0),
+      mCount(0),
+      mMotionHead(0),
+      mMotionCount(0)
+{
+    memset(mStreams, 0, sizeof(mStreams));
+    memset(mMagCal, 0, sizeof(mMagCal));
+    memset(mAlgoReq, 0, sizeof(mAlgoReq));
+    memset(mAlgoDue, 0, sizeof(mAlgoDue));
+    memset(mAlgoState, 0, sizeof(mAlgoState));
+    memset(mAlgoCount, 0, sizeof(mAlgoCount));
+    memset(&mStats, 0, sizeof(mStats));
+    pthread_mutex_init(&mLock, NULL);
+    pthread_mutex_init(&mBusLock, NULL);
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get(MSP430_EMULATE_IOCTL_US_PROPERTY, value, "0");
+    mIoctlUs = strtoul(value, NULL, 0);
+
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        struct hub_sensor const& desc = hub_sensors[handle];
+        if (desc.dt == HUB_DT_NONE || desc.bank == HUB_BANK_NONE)
+            continue;
+        struct stream& s = mStreams[desc.dt];
+        s.bank = desc.bank;
+        s.mask = desc.mask;
+        s.delay_ioctl = desc.delay_ioctl;
+        s.seconds = desc.flags & HUB_F_DELAY_SECONDS;
+        // the wake bank holds state sensors, they report on change
+        s.period = desc.bank == HUB_BANK_SENSORS ? HUB_EMU_DEFAULT_MS * 1000000LL : 0;
+    }
+
+    mDataTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ALOGE_IF(mDataTimer < 0, "Couldn't create emulator timerfd (%s)", strerror(errno));
+    mMotionTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ALOGE_IF(mMotionTimer < 0, "Couldn't create emulator timerfd (%s)", strerror(errno));
+}
+
+HubEmulator::~HubEmulator()
+{
+    if (mDataTimer >= 0)
+        close(mDataTimer);
+    if (mMotionTimer >= 0)
+        close(mMotionTimer);
+    pthread_mutex_destroy(&mLock);
+    pthread_mutex_destroy(&mBusLock);
+}
+
+/*
+ * Same contract as ioctl(2) on /dev/msp430: -1 with errno set on failure.
+ */
+int HubEmulator::ioctl(unsigned int cmd, void* arg)
+{
+    int64_t now;
+    int err = 0;
+
+    pthread_mutex_lock(&mBusLock);
+    if (mIoctlUs) {
+        struct timespec t;
+        t.tv_sec = mIoctlUs / 1000000;
+        t.tv_nsec = (mIoctlUs % 1000000) * 1000;
+        while (nanosleep(&t, &t) && errno == EINTR)
+            ;
+    }
+    now = SensorBase::getTimestamp();
+    pthread_mutex_lock(&mLock);
+    mStats.ioctls++;
+    // what was due under the old configuration comes first
+    generate(now);
+
+    switch (cmd) {
+    case MSP430_IOCTL_GET_SENSORS:
+        memcpy(arg, &mEnabled, sizeof(mEnabled));
+        break;
+    case MSP430_IOCTL_GET_WAKESENSORS:
+        memcpy(arg, &mWake, sizeof(mWake));
+        break;
+    case MSP430_IOCTL_SET_SENSORS:
+        err = setEnabled(HUB_BANK_SENSORS, arg, now);
+        break;
+    case MSP430_IOCTL_SET_WAKESENSORS:
+        err = setEnabled(HUB_BANK_WAKE, arg, now);
+        break;
+    case MSP430_IOCTL_SET_ACC_DELAY:
+    case MSP430_IOCTL_SET_GYRO_DELAY:
+    case MSP430_IOCTL_SET_MAG_DELAY:
+    case MSP430_IOCTL_SET_PRES_DELAY:
+    case MSP430_IOCTL_SET_STEP_COUNTER_DELAY:
+        err = setDelay(cmd, arg, now);
+        break;
+    case MSP430_IOCTL_GET_MAG_CAL:
+        memcpy(arg, mMagCal, sizeof(mMagCal));
+        break;
+    case MSP430_IOCTL_SET_MAG_CAL:
+        memcpy(mMagCal, arg, sizeof(mMagCal));
+        break;
+    case MSP430_IOCTL_SET_ALGOS:
+        memcpy(&mAlgos, arg, sizeof(mAlgos));
+        for (int algo = 0; algo < MSP_NUM_ALGOS; algo++)
+            mAlgoDue[algo] = now + HUB_EMU_ALGO_MS * 1000000LL;
+        break;
+    case MSP430_IOCTL_SET_ALGO_REQ:
+        err = setAlgoRequest(static_cast<const uint8_t*>(arg), now);
+        break;
+    case MSP430_IOCTL_GET_ALGO_EVT:
+        err = getAlgoEvent(static_cast<uint8_t*>(arg));
+        break;
+    case MSP430_IOCTL_SET_MOTION_DUR:
+        memcpy(&mMotionDur, arg, sizeof(mMotionDur));
+        break;
+    case MSP430_IOCTL_SET_ZRMOTION_DUR:
+        memcpy(&mZrMotionDur, arg, sizeof(mZrMotionDur));
+        break;
+    case MSP430_IOCTL_GET_VERSION:
+        *static_cast<uint8_t*>(arg) = 1;
+        break;
+    case MSP430_IOCTL_GET_VERNAME:
+        strncpy(static_cast<char*>(arg), HUB_EMU_VERSION, FW_VERSION_SIZE);
+        break;
+    default:
+        // mode switches, the time and the like have no effect here; there
+        // is nothing to answer the other reads with
+        if (_IOC_DIR(cmd) & _IOC_READ)
+            err = -ENOTTY;
+        break;
+    }
+
+    arm();
+    mStats.last_ioctl_ns = SensorBase::getTimestamp();
+    pthread_mutex_unlock(&mLock);
+    pthread_mutex_unlock(&mBusLock);
+    if (err) {
+        errno = -err;
+        return -1;
+    }
+    return 0;
+}
+
+int HubEmulator::getFd() const
+{
+    return mDataTimer;
+}
+
+ssize_t HubEmulator::read(void* buf, size_t len)
+{
+    struct msp430_android_sensor_data* out =
+            static_cast<struct msp430_android_sensor_data*>(buf);
+    uint64_t expirations;
+    int n;
+
+    pthread_mutex_lock(&mLock);
+    ::read(mDataTimer, &expirations, sizeof(expirations));
+    generate(SensorBase::getTimestamp());
+    n = len / sizeof(*out);
+    if (n > mCount)
+        n = mCount;
+    for (int i = 0; i < n; i++)
+        out[i] = mQueue[(mHead + i) % HUB_EMU_QUEUE];
+    mHead = (mHead + n) % HUB_EMU_QUEUE;
+    mCount -= n;
+    arm();
+    pthread_mutex_unlock(&mLock);
+
+    if (!n) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return n * sizeof(*out);
+}
+
+int HubEmulator::getMotionFd() const
+{
+    return mMotionTimer;
+}
+
+/*
+ * Returns msp430_moto_sensor_data records, as /dev/msp430_ms does.
+ */
+ssize_t HubEmulator::readMotion(void* buf, size_t len)
+{
+    struct msp430_moto_sensor_data* out =
+            static_cast<struct msp430_moto_sensor_data*>(buf);
+    uint64_t expirations;
+    int n;
+
+    pthread_mutex_lock(&mLock);
+    ::read(mMotionTimer, &expirations, sizeof(expirations));
+    generate(SensorBase::getTimestamp());
+    n = len / sizeof(*out);
+    if (n > mMotionCount)
+        n = mMotionCount;
+    for (int i = 0; i < n; i++)
+        out[i] = mMotion[(mMotionHead + i) % HUB_EMU_MOTION_QUEUE];
+    mMotionHead = (mMotionHead + n) % HUB_EMU_MOTION_QUEUE;
+    mMotionCount -= n;
+    arm();
+    pthread_mutex_unlock(&mLock);
+
+    if (!n) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return n * sizeof(*out);
+}
+
+void HubEmulator::getSensorhubIo(struct sensorhub_io_t* io)
+{
+    io->cookie = this;
+    io->ioctl = sensorhub_ioctl;
+    io->read = sensorhub_read;
+    io->fd = mMotionTimer;
+    io->control_fd = -1;
+}
+
+void HubEmulator::reset()
+{
+    int64_t now = SensorBase::getTimestamp();
+
+    pthread_mutex_lock(&mLock);
+    generate(now);
+    mEnabled = 0;
+    mWake = 0;
+    mAlgos = 0;
+    memset(mAlgoReq, 0, sizeof(mAlgoReq));
+    for (int type = 0; type < HUB_NUM_TYPES; type++) {
+        if (mStreams[type].bank == HUB_BANK_SENSORS)
+            mStreams[type].period = HUB_EMU_DEFAULT_MS * 1000000LL;
+    }
+    emit(DT_RESET, now);
+    queueMotion(DT_RESET, now);
+    mStats.resets++;
+    arm();
+    pthread_mutex_unlock(&mLock);
+}
+
+void HubEmulator::getStats(struct hub_emulator_stats* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    *stats = mStats;
+    pthread_mutex_unlock(&mLock);
+}
+
+void HubEmulator::setIoctlLatency(uint32_t us)
+{
+    pthread_mutex_lock(&mBusLock);
+    mIoctlUs = us;
+    pthread_mutex_unlock(&mBusLock);
+}
+
+/*
+ * Everything below runs with mLock held.
+ */
+int HubEmulator::setEnabled(int bank, const void* arg, int64_t now)
+{
+    uint16_t& mask = bank == HUB_BANK_SENSORS ? mEnabled : mWake;
+    uint16_t old = mask;
+
+    memcpy(&mask, arg, sizeof(mask));
+    for (int type = 0; type < HUB_NUM_TYPES; type++) {
+        struct stream& s = mStreams[type];
+        if (s.bank != bank || !(s.mask & mask & ~old))
+            continue;
+        // streams start one period after they are enabled, state
+        // sensors report where they are right away
+        if (s.period)
+            s.due = now + s.period;
+        else
+            emit(type, now);
+    }
+    return 0;
+}
+
+int HubEmulator::setDelay(unsigned int cmd, const void* arg, int64_t now)
+{
+    unsigned short delay;
+
+    memcpy(&delay, arg, sizeof(delay));
+    if (!delay)
+        delay = 1;
+    for (int type = 0; type < HUB_NUM_TYPES; type++) {
+        struct stream& s = mStreams[type];
+        if (s.delay_ioctl != cmd)
+            continue;
+        s.period = delay * (s.seconds ? 1000000000LL : 1000000LL);
+        if (isEnabled(s))
+            s.due = now + s.period;
+    }
+    return 0;
+}
+
+/*
+ * bytes: algo (16 bits), request length (8 bits), request. Only whether a
+ * request is in place matters, the contents shape nothing here.
+ */
+int HubEmulator::setAlgoRequest(const uint8_t* bytes, int64_t now)
+{
+    uint16_t algo;
+    uint32_t parts;
+
+    memcpy(&algo, bytes, sizeof(algo));
+    if (algo >= MSP_NUM_ALGOS)
+        return -EINVAL;
+    if (algo == MSP_IDX_ACCUM_MODALITY || algo == MSP_IDX_ACCUM_MVMT) {
+        mAlgoReq[algo] = true;
+    } else {
+        memcpy(&parts, bytes + 3, sizeof(parts));
+        mAlgoReq[algo] = parts != 0;
+    }
+    mAlgoDue[algo] = now + HUB_EMU_ALGO_MS * 1000000LL;
+    return 0;
+}
+
+/*
+ * bytes: algo (16 bits), then its event register is returned after it.
+ */
+int HubEmulator::getAlgoEvent(uint8_t* bytes)
+{
+    uint16_t algo;
+    uint8_t* p = bytes + sizeof(algo);
+
+    memcpy(&algo, bytes, sizeof(algo));
+    if (algo >= MSP_NUM_ALGOS)
+        return -EINVAL;
+    if (algo == MSP_IDX_ACCUM_MVMT) {
+        uint16_t time_s = mAlgoCount[algo] * (HUB_EMU_ALGO_MS / 1000);
+        uint16_t distance = mAlgoCount[algo] * 10;
+        p[0] = time_s & 0xff;
+        p[1] = time_s >> 8;
+        p[2] = distance & 0xff;
+        p[3] = distance >> 8;
+    } else {
+        uint16_t state = mAlgoState[algo];
+        uint16_t old = mAlgoCount[algo] ? state ^ 1 : state;
+        memset(p, 0, MSP_EVT_SZ_TRANSITION);
+        p[0] = ALGO_CONFIDENCE;
+        p[1] = old & 0xff;
+        p[2] = old >> 8;
+        p[3] = state & 0xff;
+        p[4] = state >> 8;
+    }
+    return 0;
+}
+
+bool HubEmulator::isEnabled(struct stream const& s) const
+{
+    return s.mask & (s.bank == HUB_BANK_SENSORS ? mEnabled : mWake);
+}
+
+/*
+ * Queue every record due by now, oldest first, like the hub would have.
+ */
+void HubEmulator::generate(int64_t now)
+{
+    for (;;) {
+        struct stream* next = NULL;
+        int type = 0;
+
+        for (int t = 0; t < HUB_NUM_TYPES; t++) {
+            struct stream& s = mStreams[t];
+            if (s.period && s.due <= now && isEnabled(s) &&
+                    (!next || s.due < next->due)) {
+                next = &s;
+                type = t;
+            }
+        }
+        if (!next)
+            break;
+        if (mCount == HUB_EMU_QUEUE) {
+            // nobody is reading: skip ahead rather than make records to drop
+            int64_t missed = (now - next->due) / next->period + 1;
+            mStats.overflows += missed;
+            next->seq += missed;
+            next->due += missed * next->period;
+            continue;
+        }
+        emit(type, next->due);
+        next->due += next->period;
+    }
+
+    for (int algo = 0; algo < MSP_NUM_ALGOS; algo++) {
+        if (!mAlgoReq[algo] || !(mAlgos & emu_algo_bits[algo]) || mAlgoDue[algo] > now)
+            continue;
+        emitAlgo(algo, mAlgoDue[algo]);
+        mAlgoDue[algo] = now + HUB_EMU_ALGO_MS * 1000000LL;
+    }
+}
+
+/*
+ * Synthetic but well formed values: a slow triangle wave for vectors, a
+ * unit quaternion and a counter that only goes up.
+ */
+void HubEmulator::emit(int type, int64_t when)
+{
+    if (mCount == HUB_EMU_QUEUE) {
+        mStats.overflows++;
+        return;
+    }
+    fillRecord(&mQueue[(mHead + mCount) % HUB_EMU_QUEUE], type,
+            mStreams[type].seq++, when);
+    mCount++;
+    mStats.records++;
+}
+
+/*
+ * A slow triangle wave, so vectors change from record to record without
+ * the cost of computing anything; a counter and a unit quaternion where
+ * the decoder expects those.
+ */
+void HubEmulator::fillRecord(struct msp430_android_sensor_data* rec, int type,
+        uint32_t seq, int64_t when)
+{
+    int16_t w = seq % 64 < 32 ? seq % 64 : 64 - seq % 64;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp = when;
+    rec->type = type;
+    rec->status = 3;
+    switch (type) {
+    case DT_RESET:
+        break;
+    case DT_STEP_COUNTER:
+        rec->data1 = seq & 0xffff;
+        rec->data2 = seq >> 16;
+        break;
+    case DT_QUATERNION:
+        rec->data1 = w * 16;
+        rec->data4 = 16384;         // w = 1 in Q14
+        break;
+    default:
+        rec->data1 = 100 + w * 4;
+        rec->data2 = -50 + w * 2;
+        rec->data3 = 1000 - w;
+        rec->data4 = w;
+        rec->data5 = w;
+        rec->data6 = w;
+        break;
+    }
+}
+
+/*
+ * A zeroed record of type at the end of the motion node queue, NULL when
+ * it is full.
+ */
+struct msp430_moto_sensor_data* HubEmulator::queueMotion(int type, int64_t when)
+{
+    struct msp430_moto_sensor_data* rec;
+
+    if (mMotionCount == HUB_EMU_MOTION_QUEUE) {
+        mStats.overflows++;
+        return NULL;
+    }
+    rec = &mMotion[(mMotionHead + mMotionCount) % HUB_EMU_MOTION_QUEUE];
+    mMotionCount++;
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp = when;
+    rec->type = type;
+    return rec;
+}
+
+void HubEmulator::emitAlgo(int algo, int64_t when)
+{
+    struct msp430_moto_sensor_data* rec = queueMotion(DT_ALGO_EVT, when);
+
+    if (!rec)
+        return;
+    mStats.algo_events++;
+    rec->data1 = algo << 8;
+    mAlgoCount[algo]++;
+    if (algo == MSP_IDX_ACCUM_MVMT) {
+        rec->data2 = mAlgoCount[algo] * (HUB_EMU_ALGO_MS / 1000);
+        rec->data4 = mAlgoCount[algo] * 10;
+    } else if (algo == MSP_IDX_ACCUM_MODALITY) {
+        mAlgoState[algo] ^= 1;
+        rec->data2 = mAlgoState[algo];
+    } else {
+        rec->data1 |= ALGO_CONFIDENCE;
+        rec->data2 = mAlgoState[algo];
+        mAlgoState[algo] ^= 1;
+        rec->data3 = mAlgoState[algo];
+    }
+}
+
+/*
+ * Wake the readers when their next record is due.
+ */
+void HubEmulator::arm()
+{
+    int64_t due = 0;
+
+    if (mCount) {
+        due = 1;
+    } else {
+        for (int type = 0; type < HUB_NUM_TYPES; type++) {
+            struct stream const& s = mStreams[type];
+            if (s.period && isEnabled(s) && (!due || s.due < due))
+                due = s.due;
+        }
+    }
+    if (mDataTimer >= 0)
+        arm_timer(mDataTimer, due);
+
+    due = 0;
+    if (mMotionCount) {
+        due = 1;
+    } else {
+        for (int algo = 0; algo < MSP_NUM_ALGOS; algo++) {
+            if (mAlgoReq[algo] && (mAlgos & emu_algo_bits[algo]) &&
+                    (!due || mAlgoDue[algo] < due))
+                due = mAlgoDue[algo];
+        }
+    }
+    if (mMotionTimer >= 0)
+        arm_timer(mMotionTimer, due);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_EMULATOR_H
+#define ANDROID_HUB_EMULATOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "HubBackend.h"
+#include "hub_sensors.h"
+#include "sensorhub_io.h"
+
+/*****************************************************************************/
+
+// Time each control ioctl of the emulator takes, in us, standing in for
+// the I2C transaction behind it on the real hub.
+#define MSP430_EMULATE_IOCTL_US_PROPERTY "debug.sensors.msp430.emulate_ioctl_us"
+
+// Records the data node holds for a reader that falls behind, like the
+// driver's buffer; what does not fit is lost.
+#define HUB_EMU_QUEUE           1024
+#define HUB_EMU_MOTION_QUEUE    64
+// Rate of a streaming sensor before its delay is set, or without one.
+#define HUB_EMU_DEFAULT_MS      200
+// Time between two transitions of a running algo.
+#define HUB_EMU_ALGO_MS         10000
+#define HUB_EMU_VERSION         "EMULATOR"
+
+struct hub_emulator_stats {
+    uint32_t ioctls;        // control ioctls handled
+    uint32_t records;       // data records queued
+    uint32_t overflows;     // records lost to a full queue, of either node
+    uint32_t algo_events;   // DT_ALGO_EVT records queued on the motion node
+    uint32_t resets;        // reset() calls
+    int64_t last_ioctl_ns;  // CLOCK_MONOTONIC time the latest ioctl returned
+};
+
+/*
+ * A userspace stand-in for the hub and its three device nodes. ioctl()
+ * keeps the state the control node would: the enable masks, the rate of
+ * every sensor, the magnetometer calibration and the algo requests. The
+ * data node (getFd()/read()) then carries a record for each enabled
+ * sensor at the rate it was programmed to, timestamped on CLOCK_MONOTONIC,
+ * and wake sensors report their state once when enabled. The motion node
+ * (getMotionFd()/readMotion()) carries DT_ALGO_EVT records for the running
+ * algos, which GET_ALGO_EVT also returns.
+ *
+ * Records are made when they are read, for the time each was due, so the
+ * emulator needs no thread: a timerfd per node wakes the reader when the
+ * next record is due. Every method may be called from any thread.
+ *
+ * Control ioctls can be made to take a set time, one after the other like
+ * transactions on the hub's bus, while the data node stays readable.
+ *
+ * Host only, built into libmsp430_harness: HubSensor takes it as its
+ * backend and the sensorhub module opens the control and motion nodes
+ * through getSensorhubIo().
+ */
+class HubEmulator : public HubBackend {
+public:
+            HubEmulator();
+    virtual ~HubEmulator();
+
+    virtual int ioctl(unsigned int cmd, void* arg);
+    virtual int getFd() const;
+    virtual ssize_t read(void* buf, size_t len);
+
+    int getMotionFd() const;
+    ssize_t readMotion(void* buf, size_t len);
+    // the control and motion nodes, for sensorhub_open_io()
+    void getSensorhubIo(struct sensorhub_io_t* io);
+
+    // Forget everything the hub was told and send DT_RESET on both nodes,
+    // as after a watchdog reset of the real one.
+    void reset();
+    void getStats(struct hub_emulator_stats* stats) const;
+    void setIoctlLatency(uint32_t us);
+
+    // Fill rec with the seq-th record of type the emulator would send.
+    static void fillRecord(struct msp430_android_sensor_data* rec, int type,
+            uint32_t seq, int64_t when);
+
+private:
+    struct stream {
+        uint8_t bank;           // HUB_BANK_* of its enable bit
+        uint16_t mask;
+        unsigned int delay_ioctl;
+        bool seconds;           // delay_ioctl takes seconds
+        int64_t period;         // ns between records, 0 when it reports once
+        int64_t due;            // CLOCK_MONOTONIC time of the next record
+        uint32_t seq;           // records made, drives the synthetic values
+    };
+
+    int setEnabled(int bank, const void* arg, int64_t now);
+    int setDelay(unsigned int cmd, const void* arg, int64_t now);
+    int setAlgoRequest(const uint8_t* bytes, int64_t now);
+    int getAlgoEvent(uint8_t* bytes);
+    bool isEnabled(struct stream const& s) const;
+    void generate(int64_t now);
+    void emit(int type, int64_t when);
+    void emitAlgo(int algo, int64_t when);
+    struct msp430_moto_sensor_data* queueMotion(int type, int64_t when);
+    void arm();
+
+    mutable pthread_mutex_t mLock;
+    // held for the latency of an ioctl, taken before mLock
+    pthread_mutex_t mBusLock;
+    uint32_t mIoctlUs;
+    int mDataTimer;
+    int mMotionTimer;
+
+    struct stream mStreams[HUB_NUM_TYPES];
+    uint16_t mEnabled;
+    uint16_t mWake;
+    uint16_t mAlgos;
+    uint32_t mMotionDur;
+    uint32_t mZrMotionDur;
+    uint8_t mMagCal[MSP_MAG_CAL_SIZE];
+
+    bool mAlgoReq[MSP_NUM_ALGOS];       // a SET_ALGO_REQ is in place
+    int64_t mAlgoDue[MSP_NUM_ALGOS];
+    uint16_t mAlgoState[MSP_NUM_ALGOS];
+    uint16_t mAlgoCount[MSP_NUM_ALGOS]; // transitions, accumulated movement
+
+    struct msp430_android_sensor_data mQueue[HUB_EMU_QUEUE];
+    int mHead;
+    int mCount;
+    struct msp430_moto_sensor_data mMotion[HUB_EMU_MOTION_QUEUE];
+    int mMotionHead;
+    int mMotionCount;
+
+    struct hub_emulator_stats mStats;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_EMULATOR_H
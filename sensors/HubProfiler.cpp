@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <linux/perf_event.h>
+
+#include <cutils/log.h>
+
+#include "HubProfiler.h"
+#include "HubStats.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+#define SUB_MASK ((1 << HUB_PROF_SUB_BITS) - 1)
+
+static const char* const sStageNames[HUB_PROF_DECODE] = {
+    "poll",         /* HUB_PROF_POLL */
+    "read",         /* HUB_PROF_READ */
+    "convert",      /* HUB_PROF_CONVERT */
+    "copy",         /* HUB_PROF_COPY */
+    "ioctl",        /* HUB_PROF_IOCTL */
+};
+
+/*
+ * A perf event counting the CPU cycles of the calling thread, -1 with errno
+ * set where the kernel does not allow one.
+ */
+int HubProfiler::openCounter()
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_hv = 1;
+    // reads of the data node are mostly kernel time, count it if allowed
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+// Largest value that lands in bucket, what percentiles are reported as.
+static uint64_t bucket_top(int bucket)
+{
+    if (bucket < (1 << HUB_PROF_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> HUB_PROF_SUB_BITS) - 1;
+    uint64_t base = uint64_t((1 << HUB_PROF_SUB_BITS) | (bucket & SUB_MASK)) << shift;
+    return base + (1ULL << shift) - 1;
+}
+
+static uint64_t percentile(struct hub_histogram const& h, uint32_t permille)
+{
+    uint64_t want = (uint64_t(h.count) * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HUB_PROF_BUCKETS; i++) {
+        seen += h.counts[i];
+        if (seen >= want && seen)
+            return bucket_top(i) < h.max ? bucket_top(i) : h.max;
+    }
+    return h.max;
+}
+
+static void dump_histogram(HubStatsWriter& w, struct hub_histogram const& h)
+{
+    w.field("count", h.count);
+    w.field("mean", h.count ? h.sum / h.count : 0);
+    w.field("p50", percentile(h, 500));
+    w.field("p90", percentile(h, 900));
+    w.field("p99", percentile(h, 990));
+    w.field("p999", percentile(h, 999));
+    w.field("max", h.max);
+}
+
+/*****************************************************************************/
+
+HubProfiler::HubProfiler()
+    : mHists(NULL),
+      mCycles(false)
+{
+}
+
+HubProfiler::~HubProfiler()
+{
+    if (mHists && mCycles)
+        pthread_key_delete(mCounterKey);
+    delete[] mHists;
+}
+
+/*
+ * Start recording, before the threads that record are started. Falls back
+ * to ns without a cycle counter. Returns -EINVAL when built without
+ * HUB_PROFILE.
+ */
+int HubProfiler::enable(bool cycles)
+{
+#ifdef HUB_PROFILE
+    int err;
+
+    if (mHists)
+        return 0;
+    if (cycles) {
+        int fd = openCounter();
+        if (fd < 0) {
+            ALOGE("No cycle counter, profiling in ns (%s)", strerror(errno));
+            cycles = false;
+        } else {
+            close(fd);
+        }
+    }
+    if (cycles) {
+        err = pthread_key_create(&mCounterKey, closeCounter);
+        if (err) {
+            ALOGE("Couldn't create profiler key (%s)", strerror(err));
+            return -err;
+        }
+    }
+    mCycles = cycles;
+    mHists = new struct hub_histogram[HUB_PROF_NUM_HISTS];
+    memset(mHists, 0, sizeof(struct hub_histogram) * HUB_PROF_NUM_HISTS);
+    return 0;
+#else
+    (void)cycles;
+    return -EINVAL;
+#endif
+}
+
+void HubProfiler::closeCounter(void* arg)
+{
+    close(int(intptr_t(arg)) - 1);
+}
+
+uint64_t HubProfiler::now() const
+{
+    return mCycles ? cycles() : uint64_t(SensorBase::getTimestamp());
+}
+
+/*
+ * Cycles of the calling thread, from a counter opened on its first call.
+ * Reads 0 if that thread can't have one, enable() having found one.
+ */
+uint64_t HubProfiler::cycles() const
+{
+    int fd = int(intptr_t(pthread_getspecific(mCounterKey))) - 1;
+    uint64_t count = 0;
+
+    if (fd < 0) {
+        fd = openCounter();
+        if (fd < 0) {
+            ALOGE("No cycle counter for the profiler (%s)", strerror(errno));
+            // don't try again on every sample of this thread
+            fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        pthread_setspecific(mCounterKey, (void*)intptr_t(fd + 1));
+    }
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    return count;
+}
+
+void HubProfiler::getHistogram(int hist, struct hub_histogram* h) const
+{
+    if (mHists)
+        *h = mHists[hist];
+    else
+        memset(h, 0, sizeof(*h));
+}
+
+/*
+ * Stages and record types that never ran are left out. Values are ns, or
+ * cycles when "cycles" is 1.
+ */
+void HubProfiler::dump(HubStatsWriter& w) const
+{
+    struct hub_histogram h;
+
+    if (!enabled())
+        return;
+
+    w.begin("profile");
+    w.field("cycles", mCycles);
+    for (int i = 0; i < HUB_PROF_DECODE; i++) {
+        getHistogram(i, &h);
+        if (!h.count)
+            continue;
+        w.begin(sStageNames[i]);
+        dump_histogram(w, h);
+        w.end();
+    }
+    w.beginArray("decode");
+    for (int type = 0; type <= HUB_NUM_TYPES; type++) {
+        getHistogram(HUB_PROF_DECODE + type, &h);
+        if (!h.count)
+            continue;
+        w.begin(NULL);
+        // HUB_NUM_TYPES stands for the records of no known type
+        w.field("type", type < HUB_NUM_TYPES ? type : -1);
+        dump_histogram(w, h);
+        w.end();
+    }
+    w.endArray();
+    w.end();
+}
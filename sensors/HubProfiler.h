@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_PROFILER_H
+#define ANDROID_HUB_PROFILER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "hub_sensors.h"
+
+/*****************************************************************************/
+
+// Time the stages of the data path: "0" off, "1" in CLOCK_MONOTONIC ns,
+// "cycles" in CPU cycles of the calling thread where perf events allow.
+// Read when the HAL starts; builds without HUB_PROFILE ignore it.
+#define MSP430_PROFILE_PROPERTY "debug.sensors.msp430.profile"
+
+// Stages timed, each a histogram of its own.
+#define HUB_PROF_POLL       0   // poll() that found data ready, sleep included
+#define HUB_PROF_READ       1   // read() of the data node, or of the reader ring
+#define HUB_PROF_CONVERT    2   // batch conversion of the triaxial samples
+#define HUB_PROF_COPY       3   // events handed on to the framework or a batch FIFO
+#define HUB_PROF_IOCTL      4   // ioctl to the hub, on the control thread
+#define HUB_PROF_DECODE     5   // decode and decimation of one record, by DT_* type
+#define HUB_PROF_NUM_HISTS  (HUB_PROF_DECODE + HUB_NUM_TYPES + 1)
+
+// Log-linear buckets: exact below 2^SUB_BITS, then 2^SUB_BITS buckets per
+// power of two, i.e. within 1/16 of the value, up to 2^HUB_PROF_MAX_BITS.
+#define HUB_PROF_SUB_BITS   4
+#define HUB_PROF_MAX_BITS   36
+#define HUB_PROF_BUCKETS    ((HUB_PROF_MAX_BITS - HUB_PROF_SUB_BITS + 1) << HUB_PROF_SUB_BITS)
+
+struct hub_histogram {
+    uint32_t counts[HUB_PROF_BUCKETS];
+    uint32_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+class HubStatsWriter;
+
+/*
+ * Times the stages of one pollEvents() cycle into HDR-style histograms,
+ * one per stage and one per DT_* record type for the decode.
+ *
+ * A stage is timed as
+ *
+ *     uint64_t t0 = profiler.start();
+ *     ...
+ *     profiler.stop(HUB_PROF_READ, t0);
+ *
+ * Until enable(), start() and stop() are a test of one member and nothing
+ * is allocated; built without HUB_PROFILE they are empty and compile away.
+ * Each histogram has a single writer thread, so recording is plain stores;
+ * a dump reads them while they are written and may be a sample or two off.
+ *
+ * Timestamps come from the vDSO clock. Cycle counts are read() from a perf
+ * event of the calling thread, opened on its first sample; at a syscall per
+ * read they inflate the shortest stages, and they are left to profiling
+ * sessions.
+ */
+class HubProfiler {
+public:
+            HubProfiler();
+            ~HubProfiler();
+
+    int enable(bool cycles);
+    void getHistogram(int hist, struct hub_histogram* h) const;
+    void dump(HubStatsWriter& w) const;
+
+#ifdef HUB_PROFILE
+    bool enabled() const { return mHists != NULL; }
+#else
+    bool enabled() const { return false; }
+#endif
+
+    uint64_t start() const { return enabled() ? now() : 0; }
+    void stop(int hist, uint64_t t0) {
+        if (enabled())
+            record(mHists[hist], now() - t0);
+    }
+    static int decodeHist(unsigned type) {
+        return HUB_PROF_DECODE + (type < HUB_NUM_TYPES ? type : HUB_NUM_TYPES);
+    }
+    static int openCounter();
+
+private:
+    static void closeCounter(void* arg);
+    uint64_t now() const;
+    uint64_t cycles() const;
+    static void record(struct hub_histogram& h, uint64_t value);
+
+    struct hub_histogram* mHists;   // NULL while off
+    bool mCycles;
+    pthread_key_t mCounterKey;      // perf event fd + 1 of each thread
+};
+
+inline void HubProfiler::record(struct hub_histogram& h, uint64_t value)
+{
+    int bucket;
+
+    if (value < (1 << HUB_PROF_SUB_BITS)) {
+        bucket = int(value);
+    } else if (value >> HUB_PROF_MAX_BITS) {
+        bucket = HUB_PROF_BUCKETS - 1;
+    } else {
+        int shift = 63 - __builtin_clzll(value) - HUB_PROF_SUB_BITS;
+        bucket = ((shift + 1) << HUB_PROF_SUB_BITS) +
+                int((value >> shift) & ((1 << HUB_PROF_SUB_BITS) - 1));
+    }
+    h.counts[bucket]++;
+    h.count++;
+    h.sum += value;
+    if (value > h.max)
+        h.max = value;
+}
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_PROFILER_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "HubReader.h"
+
+/*****************************************************************************/
+
+#define RING_MASK (HUB_READER_RING_SIZE - 1)
+
+HubReader::HubReader(int data_fd)
+    : mDataFd(data_fd),
+      mEventFd(-1),
+      mStopFd(-1),
+      mRunning(false),
+      mHead(0),
+      mTail(0),
+      mReadCalls(0),
+      mRecords(0),
+      mOverflows(0),
+      mPeak(0)
+{
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mEventFd < 0, "Couldn't create reader eventfd (%s)", strerror(errno));
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mStopFd < 0, "Couldn't create reader stop eventfd (%s)", strerror(errno));
+}
+
+HubReader::~HubReader()
+{
+    stop();
+    if (mEventFd >= 0)
+        close(mEventFd);
+    if (mStopFd >= 0)
+        close(mStopFd);
+}
+
+int HubReader::start()
+{
+    int err;
+
+    if (mRunning)
+        return 0;
+    if (mDataFd < 0 || mEventFd < 0 || mStopFd < 0)
+        return -EINVAL;
+
+    err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        ALOGE("Couldn't start hub reader thread (%s)", strerror(err));
+        return -err;
+    }
+    mRunning = true;
+    return 0;
+}
+
+void HubReader::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    mRunning = false;
+}
+
+int HubReader::getFd() const
+{
+    return mEventFd;
+}
+
+void* HubReader::threadLoop(void* arg)
+{
+    static_cast<HubReader*>(arg)->run();
+    return NULL;
+}
+
+void HubReader::run()
+{
+    const size_t recSize = sizeof(struct msp430_android_sensor_data);
+    struct msp430_android_sensor_data batch[HUB_READER_BATCH];
+    struct pollfd fds[2];
+    size_t bytes = 0;
+    uint64_t one = 1;
+    ssize_t ret;
+    int n;
+
+    fds[0].fd = mDataFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("reader poll() failed (%s)", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            ALOGE("hub data node went away, reader thread exiting");
+            break;
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        // drain the node completely before going back to sleep
+        do {
+            ret = ::read(mDataFd, (char *)batch + bytes, sizeof(batch) - bytes);
+            android_atomic_inc(&mReadCalls);
+            if (ret <= 0)
+                break;
+            bytes += ret;
+            n = bytes / recSize;
+            if (n && push(batch, n))
+                write(mEventFd, &one, sizeof(one));
+            bytes -= n * recSize;
+            if (bytes)
+                memmove(batch, &batch[n], bytes);
+        } while (ret > 0);
+
+        if (ret < 0 && errno != EAGAIN && errno != EINTR)
+            ALOGE("reader read() failed (%s)", strerror(errno));
+    }
+}
+
+/*
+ * Producer side, called from the reader thread only. Records that do not
+ * fit are dropped and counted; the kernel buffer behind us would drop them
+ * as well, this at least keeps the reader from blocking the driver.
+ */
+int HubReader::push(const struct msp430_android_sensor_data* src, int n)
+{
+    int32_t head = mHead;
+    int32_t tail = android_atomic_acquire_load(&mTail);
+    int32_t room = HUB_READER_RING_SIZE - (head - tail);
+    int32_t used;
+    int i;
+
+    if (n > room) {
+        android_atomic_add(n - room, &mOverflows);
+        n = room;
+    }
+    for (i = 0; i < n; i++)
+        mRing[(head + i) & RING_MASK] = src[i];
+
+    android_atomic_release_store(head + n, &mHead);
+    android_atomic_add(n, &mRecords);
+
+    used = head + n - tail;
+    if (used > mPeak)
+        android_atomic_release_store(used, &mPeak);
+    return n;
+}
+
+/*
+ * Consumer side, called from the poll thread only. The eventfd is cleared
+ * before the ring is looked at a second time, so a push racing with us
+ * either lands in this read or signals the eventfd again.
+ */
+int HubReader::read(struct msp430_android_sensor_data* dst, int max)
+{
+    int32_t tail = mTail;
+    int32_t head = android_atomic_acquire_load(&mHead);
+    uint64_t value;
+    int n, i;
+
+    if (head == tail) {
+        ::read(mEventFd, &value, sizeof(value));
+        head = android_atomic_acquire_load(&mHead);
+    }
+
+    n = head - tail;
+    if (n > max)
+        n = max;
+    for (i = 0; i < n; i++)
+        dst[i] = mRing[(tail + i) & RING_MASK];
+
+    android_atomic_release_store(tail + n, &mTail);
+    return n;
+}
+
+bool HubReader::hasRecords() const
+{
+    return android_atomic_acquire_load(&mHead) != mTail;
+}
+
+void HubReader::getStats(struct hub_reader_stats* stats) const
+{
+    stats->read_calls = android_atomic_acquire_load(&mReadCalls);
+    stats->records = android_atomic_acquire_load(&mRecords);
+    stats->overflows = android_atomic_acquire_load(&mOverflows);
+    stats->occupancy = android_atomic_acquire_load(&mHead) -
+            android_atomic_acquire_load(&mTail);
+    stats->peak = android_atomic_acquire_load(&mPeak);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_READER_H
+#define ANDROID_HUB_READER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "linux/msp430.h"
+
+/*****************************************************************************/
+
+// Records buffered between the reader thread and poll(), must be a power of 2.
+#define HUB_READER_RING_SIZE 512
+#define HUB_READER_BATCH 32
+
+struct hub_reader_stats {
+    uint32_t read_calls;    // read() syscalls issued by the reader thread
+    uint32_t records;       // records pushed into the ring
+    uint32_t overflows;     // records dropped because the ring was full
+    uint32_t occupancy;     // records currently in the ring
+    uint32_t peak;          // highest occupancy seen
+};
+
+/*
+ * Drains a hub data node from its own thread into a single-producer /
+ * single-consumer ring. The consumer polls getFd(), an eventfd that is
+ * signalled whenever new records are pushed, and pulls them with read().
+ */
+class HubReader {
+public:
+            HubReader(int data_fd);
+            ~HubReader();
+
+    int start();
+    void stop();
+
+    int getFd() const;
+    int read(struct msp430_android_sensor_data* dst, int max);
+    bool hasRecords() const;
+    void getStats(struct hub_reader_stats* stats) const;
+
+private:
+    static void* threadLoop(void* arg);
+    void run();
+    int push(const struct msp430_android_sensor_data* src, int n);
+
+    int mDataFd;
+    int mEventFd;
+    int mStopFd;
+    pthread_t mThread;
+    bool mRunning;
+
+    struct msp430_android_sensor_data mRing[HUB_READER_RING_SIZE];
+    volatile int32_t mHead;     // written by the reader thread only
+    volatile int32_t mTail;     // written by the consumer only
+
+    volatile int32_t mReadCalls;
+    volatile int32_t mRecords;
+    volatile int32_t mOverflows;
+    volatile int32_t mPeak;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_READER_H
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "HubRecorder.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+static uint8_t* put_varint(uint8_t* p, int64_t v)
+{
+    uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+
+    while (u >= 0x80) {
+        *p++ = (uint8_t)u | 0x80;
+        u >>= 7;
+    }
+    *p++ = (uint8_t)u;
+    return p;
+}
+
+HubRecorder::HubRecorder(const char* path)
+    : mFd(-1),
+      mEventFd(-1),
+      mStopFd(-1),
+      mRunning(false),
+      mHead(0),
+      mTail(0),
+      mBlockLen(0),
+      mBlockCount(0),
+      mBlockStart(0),
+      mPrevTs(0),
+      mOffset(0),
+      mTotal(0),
+      mIndex(NULL),
+      mIndexCount(0),
+      mIndexSize(0),
+      mRecords(0),
+      mDropped(0),
+      mBlocks(0),
+      mBytes(0),
+      mErrors(0)
+{
+    snprintf(mPath, sizeof(mPath), "%s", path);
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mEventFd < 0, "Couldn't create capture eventfd (%s)", strerror(errno));
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ALOGE_IF(mStopFd < 0, "Couldn't create capture stop eventfd (%s)", strerror(errno));
+}
+
+HubRecorder::~HubRecorder()
+{
+    stop();
+    if (mEventFd >= 0)
+        close(mEventFd);
+    if (mStopFd >= 0)
+        close(mStopFd);
+    free(mIndex);
+}
+
+int HubRecorder::start()
+{
+    struct hub_capture_header hdr;
+    int err;
+
+    if (mRunning)
+        return 0;
+    if (mEventFd < 0 || mStopFd < 0)
+        return -EINVAL;
+
+    // a new file of our own, never one already there or behind a link
+    mFd = open(mPath, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0640);
+    if (mFd < 0) {
+        err = -errno;
+        ALOGE("Can't create capture %s (%s)", mPath, strerror(errno));
+        return err;
+    }
+    hdr.magic = HUB_CAPTURE_MAGIC;
+    hdr.version = HUB_CAPTURE_VERSION;
+    hdr.record_size = sizeof(struct msp430_android_sensor_data);
+    hdr.reserved = 0;
+    err = writeAll(&hdr, sizeof(hdr));
+    if (!err) {
+        mOffset = sizeof(hdr);
+        err = -pthread_create(&mThread, NULL, threadLoop, this);
+    }
+    if (err) {
+        ALOGE("Couldn't start capture writer (%s)", strerror(-err));
+        close(mFd);
+        mFd = -1;
+        return err;
+    }
+    mRunning = true;
+    return 0;
+}
+
+/*
+ * Everything appended so far is written, with the index, before this
+ * returns.
+ */
+void HubRecorder::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    mRunning = false;
+    close(mFd);
+    mFd = -1;
+}
+
+/*
+ * Never blocks: records that do not fit in the ring are counted and lost.
+ */
+void HubRecorder::append(const struct msp430_android_sensor_data* rec, int n)
+{
+    int32_t head = mHead;
+    int32_t used = head - android_atomic_acquire_load(&mTail);
+    uint64_t one = 1;
+    int i;
+
+    if (!mRunning || n <= 0)
+        return;
+    if (n > HUB_REC_RING - used) {
+        android_atomic_add(n - (HUB_REC_RING - used), &mDropped);
+        n = HUB_REC_RING - used;
+    }
+    for (i = 0; i < n; i++)
+        mRing[(head + i) & (HUB_REC_RING - 1)] = rec[i];
+    android_atomic_release_store(head + n, &mHead);
+
+    // otherwise the writer comes by on its own within HUB_REC_DRAIN_MS
+    if (used < HUB_REC_RING / 2 && used + n >= HUB_REC_RING / 2)
+        write(mEventFd, &one, sizeof(one));
+}
+
+void HubRecorder::getStats(struct hub_recorder_stats* stats) const
+{
+    stats->records = android_atomic_acquire_load(&mRecords);
+    stats->dropped = android_atomic_acquire_load(&mDropped);
+    stats->blocks = android_atomic_acquire_load(&mBlocks);
+    stats->bytes = android_atomic_acquire_load(&mBytes);
+    stats->errors = android_atomic_acquire_load(&mErrors);
+}
+
+void* HubRecorder::threadLoop(void* arg)
+{
+    static_cast<HubRecorder*>(arg)->run();
+    return NULL;
+}
+
+void HubRecorder::run()
+{
+    struct pollfd fds[2];
+    uint64_t count;
+    int n;
+
+    fds[0].fd = mEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        fds[0].revents = fds[1].revents = 0;
+        n = poll(fds, 2, HUB_REC_DRAIN_MS);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("capture writer poll() failed (%s)", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+        if (fds[0].revents & POLLIN)
+            read(mEventFd, &count, sizeof(count));
+        drain();
+        int64_t nowMs = SensorBase::getTimestamp() / 1000000;
+        if (mBlockCount && nowMs - mBlockStart >= HUB_REC_FLUSH_MS)
+            writeBlock();
+    }
+    drain();
+    writeBlock();
+    finish();
+}
+
+/*
+ * Runs on the writer thread, like everything below.
+ */
+void HubRecorder::drain()
+{
+    int32_t tail = mTail;
+    int32_t head = android_atomic_acquire_load(&mHead);
+
+    while (tail != head) {
+        encode(mRing[tail & (HUB_REC_RING - 1)]);
+        tail++;
+        // hand the slot back as soon as it is encoded
+        android_atomic_release_store(tail, &mTail);
+    }
+}
+
+void HubRecorder::encode(struct msp430_android_sensor_data const& rec)
+{
+    struct hub_capture_block* blk = (struct hub_capture_block*)mBlock;
+    uint8_t* p;
+
+    if (mErrors)
+        return;
+    if (!mBlockCount) {
+        blk->base = rec.timestamp;
+        mPrevTs = rec.timestamp;
+        mBlockLen = sizeof(*blk);
+        mBlockStart = SensorBase::getTimestamp() / 1000000;
+    }
+
+    p = mBlock + mBlockLen;
+    *p++ = rec.type;
+    *p++ = rec.status;
+    p = put_varint(p, rec.timestamp - mPrevTs);
+    p = put_varint(p, rec.data1);
+    p = put_varint(p, rec.data2);
+    p = put_varint(p, rec.data3);
+    p = put_varint(p, rec.data4);
+    p = put_varint(p, rec.data5);
+    p = put_varint(p, rec.data6);
+    mPrevTs = rec.timestamp;
+    mBlockLen = p - mBlock;
+    mBlockCount++;
+    android_atomic_inc(&mRecords);
+
+    if (mBlockCount == HUB_REC_BLOCK_RECORDS)
+        writeBlock();
+}
+
+int HubRecorder::writeBlock()
+{
+    struct hub_capture_block* blk = (struct hub_capture_block*)mBlock;
+    int err;
+
+    if (!mBlockCount)
+        return 0;
+    if (mIndexCount == mIndexSize) {
+        uint32_t size = mIndexSize ? mIndexSize * 2 : 64;
+        void* index = realloc(mIndex, size * sizeof(*mIndex));
+        if (index) {
+            mIndex = static_cast<struct hub_capture_index*>(index);
+            mIndexSize = size;
+        }
+    }
+
+    blk->magic = HUB_CAPTURE_BLOCK_MAGIC;
+    blk->count = mBlockCount;
+    blk->bytes = mBlockLen - sizeof(*blk);
+    blk->reserved = 0;
+    if (mIndexCount == mIndexSize)
+        err = -ENOMEM;
+    else
+        err = writeAll(mBlock, mBlockLen);
+    if (err) {
+        ALOGE("Can't write capture %s (%s), recording stops", mPath, strerror(-err));
+        android_atomic_inc(&mErrors);
+        mBlockCount = 0;
+        return err;
+    }
+
+    mIndex[mIndexCount].first = blk->base;
+    mIndex[mIndexCount].offset = mOffset;
+    mIndex[mIndexCount].record = mTotal;
+    mIndexCount++;
+    mOffset += mBlockLen;
+    mTotal += mBlockCount;
+    android_atomic_inc(&mBlocks);
+    android_atomic_add(mBlockLen, &mBytes);
+    mBlockCount = 0;
+    return 0;
+}
+
+/*
+ * Append the index and the footer that points at it.
+ */
+int HubRecorder::finish()
+{
+    struct hub_capture_footer footer;
+    int err;
+
+    if (mErrors)
+        return -EIO;
+    footer.magic = HUB_CAPTURE_INDEX_MAGIC;
+    footer.count = mIndexCount;
+    footer.offset = mOffset;
+    err = writeAll(mIndex, mIndexCount * sizeof(*mIndex));
+    if (!err)
+        err = writeAll(&footer, sizeof(footer));
+    if (!err && fsync(mFd))
+        err = -errno;
+    ALOGE_IF(err, "Can't finish capture %s (%s)", mPath, strerror(-err));
+    return err;
+}
+
+int HubRecorder::writeAll(const void* buf, size_t len)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    ssize_t ret;
+
+    while (len) {
+        ret = write(mFd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
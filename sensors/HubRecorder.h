@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_RECORDER_H
+#define ANDROID_HUB_RECORDER_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "linux/msp430.h"
+
+/*****************************************************************************/
+
+// File name, in HUB_CAPTURE_DIR, to record the raw hub records to. Only
+// honoured with ro.debuggable=1; nothing is recorded when unset. The
+// directory is made by init.target.rc, the HAL doesn't create it.
+#define MSP430_CAPTURE_PROPERTY "debug.sensors.msp430.capture"
+#define HUB_CAPTURE_DIR         "/data/misc/sensors"
+
+/*
+ * Capture file layout, all fields little endian:
+ *
+ *   header  { HUB_CAPTURE_MAGIC, version, record size, 0 }
+ *   blocks  { HUB_CAPTURE_BLOCK_MAGIC, records, payload bytes, 0, base ts }
+ *           followed by the records, each one
+ *             type, status                          1 byte each
+ *             timestamp - previous one (base ts)    zigzag varint
+ *             data1 .. data6                        zigzag varint
+ *   index   { first ts, file offset, first record } per block
+ *   footer  { HUB_CAPTURE_INDEX_MAGIC, blocks, index offset }
+ *
+ * Each block decodes on its own, so the index is enough to seek. The index
+ * and footer are written when recording stops; a capture cut short still
+ * decodes by walking the blocks.
+ */
+#define HUB_CAPTURE_MAGIC           0x50414348  // "HCAP"
+#define HUB_CAPTURE_BLOCK_MAGIC     0x4b4c4248  // "HBLK"
+#define HUB_CAPTURE_INDEX_MAGIC     0x58444948  // "HIDX"
+#define HUB_CAPTURE_VERSION         1
+
+struct hub_capture_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct hub_capture_block {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t bytes;
+    uint32_t reserved;
+    int64_t base;
+};
+
+struct hub_capture_index {
+    int64_t first;
+    uint64_t offset;
+    uint64_t record;
+};
+
+struct hub_capture_footer {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t offset;
+};
+
+// Largest encoded record: two bytes, a 64-bit and six 16-bit varints.
+#define HUB_CAPTURE_MAX_RECORD  (2 + 10 + 6 * 3)
+
+/*
+ * Decode the record at p, whose timestamp is relative to *ts, and move *ts
+ * to it. Returns the bytes used, or -1 if the record runs past end.
+ */
+static inline int hub_capture_decode(const uint8_t* p, const uint8_t* end,
+        int64_t* ts, struct msp430_android_sensor_data* rec)
+{
+    const uint8_t* const start = p;
+    int64_t v[7];
+
+    if (end - p < 2)
+        return -1;
+    rec->type = *p++;
+    rec->status = *p++;
+    for (int i = 0; i < 7; i++) {
+        uint64_t u = 0;
+        int shift = 0;
+        do {
+            if (p == end || shift > 63)
+                return -1;
+            u |= (uint64_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        v[i] = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    }
+    *ts += v[0];
+    rec->timestamp = *ts;
+    rec->data1 = v[1];
+    rec->data2 = v[2];
+    rec->data3 = v[3];
+    rec->data4 = v[4];
+    rec->data5 = v[5];
+    rec->data6 = v[6];
+    return p - start;
+}
+
+/*****************************************************************************/
+
+// Records buffered between the data path and the writer, a power of two.
+#define HUB_REC_RING            4096
+// Records per block, bounds what a crash can lose besides the ring.
+#define HUB_REC_BLOCK_RECORDS   1024
+// The writer drains this often, or as soon as the ring is half full.
+#define HUB_REC_DRAIN_MS        100
+// A block older than this is written even if it is not full.
+#define HUB_REC_FLUSH_MS        1000
+
+struct hub_recorder_stats {
+    uint32_t records;       // records encoded
+    uint32_t dropped;       // records lost because the ring was full
+    uint32_t blocks;        // blocks written
+    uint32_t bytes;         // bytes written
+    uint32_t errors;        // failed writes, the capture stops at the first
+};
+
+/*
+ * Records the raw hub stream to a capture file, see the layout above.
+ * append() runs on the data path: it copies the records into a ring and
+ * returns, dropping what does not fit rather than waiting. A writer thread
+ * drains the ring, encodes whole blocks and writes each with one write().
+ * Only one thread may append().
+ */
+class HubRecorder {
+public:
+            HubRecorder(const char* path);
+            ~HubRecorder();
+
+    int start();
+    void stop();
+
+    void append(const struct msp430_android_sensor_data* rec, int n);
+    void getStats(struct hub_recorder_stats* stats) const;
+
+private:
+    static void* threadLoop(void* arg);
+    void run();
+    void drain();
+    void encode(struct msp430_android_sensor_data const& rec);
+    int writeBlock();
+    int finish();
+    int writeAll(const void* buf, size_t len);
+
+    char mPath[PATH_MAX];
+    int mFd;
+    int mEventFd;
+    int mStopFd;
+    pthread_t mThread;
+    bool mRunning;
+
+    // ring: only append() moves mHead, only the writer moves mTail
+    struct msp430_android_sensor_data mRing[HUB_REC_RING];
+    volatile int32_t mHead;
+    volatile int32_t mTail;
+
+    // the block being encoded, header first
+    uint8_t mBlock[sizeof(struct hub_capture_block) +
+            HUB_REC_BLOCK_RECORDS * HUB_CAPTURE_MAX_RECORD] __attribute__((aligned(8)));
+    size_t mBlockLen;
+    uint32_t mBlockCount;
+    int64_t mBlockStart;        // CLOCK_MONOTONIC ms the block was started
+    int64_t mPrevTs;
+    uint64_t mOffset;           // file offset of the next block
+    uint64_t mTotal;            // records in the blocks written
+
+    struct hub_capture_index* mIndex;
+    uint32_t mIndexCount;
+    uint32_t mIndexSize;
+
+    volatile int32_t mRecords;
+    volatile int32_t mDropped;
+    volatile int32_t mBlocks;
+    volatile int32_t mBytes;
+    volatile int32_t mErrors;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_RECORDER_H
@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cutils/log.h>
+#include <private/android_filesystem_config.h>
+
+#include "HubStats.h"
+#include "SensorBase.h"
+#include "hub_sensors.h"
+
+/*****************************************************************************/
+
+// Time a client gets to send its request and take the dump.
+#define CLIENT_TIMEOUT_MS   1000
+// A window this much older than its length means the sensor went quiet.
+#define STALE_WINDOWS       2
+
+/*****************************************************************************/
+
+HubStatsWriter::HubStatsWriter(bool json)
+    : mBuf(NULL),
+      mSize(0),
+      mCapacity(0),
+      mJson(json),
+      mDepth(json ? 1 : 0)
+{
+    // JSON members sit one level in, inside the outer braces
+    mFirst[mDepth] = true;
+    if (mJson)
+        append("{");
+}
+
+HubStatsWriter::~HubStatsWriter()
+{
+    free(mBuf);
+}
+
+void HubStatsWriter::append(const char* fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    for (;;) {
+        va_start(ap, fmt);
+        len = vsnprintf(mBuf + mSize, mCapacity - mSize, fmt, ap);
+        va_end(ap);
+        if (len < 0)
+            return;
+        if (mSize + len < mCapacity)
+            break;
+        size_t capacity = mCapacity ? mCapacity * 2 : 4096;
+        while (capacity <= mSize + len)
+            capacity *= 2;
+        char* buf = static_cast<char*>(realloc(mBuf, capacity));
+        if (!buf)
+            return;
+        mBuf = buf;
+        mCapacity = capacity;
+    }
+    mSize += len;
+}
+
+void HubStatsWriter::indent()
+{
+    append("\n%*s", mDepth * 2, "");
+}
+
+// JSON wants a comma between members, text a new line for each.
+void HubStatsWriter::separate()
+{
+    if (mJson && !mFirst[mDepth])
+        append(",");
+    mFirst[mDepth] = false;
+    indent();
+}
+
+void HubStatsWriter::begin(const char* name)
+{
+    separate();
+    if (mJson)
+        append(name ? "\"%s\": {" : "{", name);
+    else
+        append("%s:", name ? name : "-");
+    if (mDepth < HUB_STATS_DEPTH)
+        mDepth++;
+    mFirst[mDepth] = true;
+}
+
+void HubStatsWriter::beginArray(const char* name)
+{
+    separate();
+    if (mJson)
+        append("\"%s\": [", name);
+    else
+        append("%s:", name);
+    if (mDepth < HUB_STATS_DEPTH)
+        mDepth++;
+    mFirst[mDepth] = true;
+}
+
+void HubStatsWriter::end()
+{
+    if (mDepth > 0)
+        mDepth--;
+    if (mJson) {
+        indent();
+        append("}");
+    }
+}
+
+void HubStatsWriter::endArray()
+{
+    if (mDepth > 0)
+        mDepth--;
+    if (mJson) {
+        indent();
+        append("]");
+    }
+}
+
+void HubStatsWriter::field(const char* name, int64_t value)
+{
+    separate();
+    append(mJson ? "\"%s\": %lld" : "%s: %lld", name, (long long)value);
+}
+
+void HubStatsWriter::finish()
+{
+    mDepth = 0;
+    if (mJson) {
+        indent();
+        append("}");
+    }
+    append("\n");
+}
+
+/*****************************************************************************/
+
+HubStats::HubStats()
+    : mIoctls(0),
+      mIoctlErrors(0),
+      mLastErrorCmd(0),
+      mLastErrno(0),
+      mDump(NULL),
+      mCookie(NULL),
+      mListenFd(-1),
+      mStopFd(-1),
+      mRunning(false)
+{
+    memset(mHandles, 0, sizeof(mHandles));
+}
+
+HubStats::~HubStats()
+{
+    stop();
+}
+
+int HubStats::start(dump_t dump, void* cookie)
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    int err;
+
+    if (mRunning)
+        return 0;
+
+    // abstract namespace: leading NUL, name not NUL terminated
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path + 1, HUB_STATS_SOCKET, sizeof(addr.sun_path) - 2);
+    len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(HUB_STATS_SOCKET);
+
+    mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mListenFd < 0) {
+        err = -errno;
+        ALOGE("Couldn't create stats socket (%s)", strerror(errno));
+        return err;
+    }
+    if (bind(mListenFd, (struct sockaddr*)&addr, len) || listen(mListenFd, 4)) {
+        err = -errno;
+        ALOGE("Couldn't listen on @%s (%s)", HUB_STATS_SOCKET, strerror(errno));
+        goto fail;
+    }
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mStopFd < 0) {
+        err = -errno;
+        ALOGE("Couldn't create stats stop eventfd (%s)", strerror(errno));
+        goto fail;
+    }
+
+    mDump = dump;
+    mCookie = cookie;
+    err = pthread_create(&mThread, NULL, threadLoop, this);
+    if (err) {
+        ALOGE("Couldn't start stats thread (%s)", strerror(err));
+        err = -err;
+        goto fail;
+    }
+    mRunning = true;
+    return 0;
+
+fail:
+    close(mListenFd);
+    mListenFd = -1;
+    if (mStopFd >= 0)
+        close(mStopFd);
+    mStopFd = -1;
+    return err;
+}
+
+void HubStats::stop()
+{
+    uint64_t one = 1;
+
+    if (!mRunning)
+        return;
+    write(mStopFd, &one, sizeof(one));
+    pthread_join(mThread, NULL);
+    close(mListenFd);
+    close(mStopFd);
+    mListenFd = -1;
+    mStopFd = -1;
+    mRunning = false;
+}
+
+void* HubStats::threadLoop(void* arg)
+{
+    HubStats* self = static_cast<HubStats*>(arg);
+    struct pollfd fds[2];
+
+    fds[0].fd = self->mStopFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = self->mListenFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        int n = poll(fds, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("stats poll() failed (%s)", strerror(errno));
+            break;
+        }
+        if (fds[0].revents)
+            break;
+        if (fds[1].revents & POLLIN) {
+            int fd = accept4(self->mListenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                self->serve(fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * One client at a time: the dump is small and the thread does nothing
+ * else. The timeouts keep a client that never reads from holding it.
+ */
+void HubStats::serve(int fd)
+{
+    struct timeval tv = { CLIENT_TIMEOUT_MS / 1000, (CLIENT_TIMEOUT_MS % 1000) * 1000 };
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    char request[16];
+    ssize_t n;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+        return;
+    if (cred.uid != AID_ROOT && cred.uid != AID_SYSTEM && cred.uid != AID_SHELL) {
+        ALOGE("stats: refusing uid %d", (int)cred.uid);
+        return;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n < 0)
+        return;
+    request[n] = 0;
+
+    HubStatsWriter w(!strncmp(request, "json", 4));
+    mDump(mCookie, w);
+    w.finish();
+
+    const char* p = w.data();
+    size_t left = w.size();
+    while (left) {
+        n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+}
+
+/*****************************************************************************/
+
+void HubStats::setDelay(int handle, int64_t ns)
+{
+    mHandles[handle].delayUs = int32_t(ns / 1000);
+}
+
+/*
+ * The HubBackend contract: ret is -1 with the reason in err on failure.
+ */
+void HubStats::ioctl(unsigned int cmd, int ret, int err)
+{
+    bump(mIoctls);
+    if (ret < 0) {
+        bump(mIoctlErrors);
+        mLastErrorCmd = int32_t(cmd);
+        mLastErrno = err;
+    }
+}
+
+void HubStats::get(int handle, struct hub_handle_stats* stats) const
+{
+    struct counters const& c = mHandles[handle];
+    int32_t windowMs = c.windowMs;
+
+    stats->records = c.records;
+    stats->events = c.events;
+    stats->filtered = c.filtered;
+    stats->discarded = c.discarded;
+    stats->decimated = c.decimated;
+    stats->delay_us = c.delayUs;
+    // the rate is only brought up to date by events, not by their absence
+    if (int32_t(SensorBase::getTimestamp() / 1000000) - windowMs > STALE_WINDOWS * HUB_STATS_WINDOW_MS)
+        stats->rate_mhz = 0;
+    else
+        stats->rate_mhz = c.rateMhz;
+}
+
+void HubStats::getIoctlStats(struct hub_ioctl_stats* stats) const
+{
+    stats->ioctls = mIoctls;
+    stats->errors = mIoctlErrors;
+    stats->last_error_cmd = mLastErrorCmd;
+    stats->last_errno = mLastErrno;
+}
+
+/*
+ * Handles that never saw a record nor a client are left out. requested_mhz
+ * is what setDelay() asked for, to be held against rate_mhz.
+ */
+void HubStats::dumpHandles(HubStatsWriter& w, uint32_t clients) const
+{
+    struct hub_handle_stats s;
+
+    w.beginArray("handles");
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        bool enabled = clients & (1 << handle);
+
+        get(handle, &s);
+        if (!s.records && !s.events && !enabled)
+            continue;
+        w.begin(NULL);
+        w.field("handle", handle);
+        w.field("type", hub_sensors[handle].type);
+        w.field("enabled", enabled);
+        w.field("records", s.records);
+        w.field("events", s.events);
+        w.field("filtered", s.filtered);
+        w.field("discarded", s.discarded);
+        w.field("decimated", s.decimated);
+        w.field("delay_us", s.delay_us);
+        w.field("requested_mhz", s.delay_us ? 1000000000LL / s.delay_us : 0);
+        w.field("rate_mhz", s.rate_mhz);
+        w.end();
+    }
+    w.endArray();
+}
+
+void HubStats::dumpIoctls(HubStatsWriter& w) const
+{
+    struct hub_ioctl_stats s;
+
+    getIoctlStats(&s);
+    w.begin("ioctl");
+    w.field("ioctls", s.ioctls);
+    w.field("errors", s.errors);
+    w.field("last_error_cmd", s.last_error_cmd);
+    w.field("last_errno", s.last_errno);
+    w.end();
+}
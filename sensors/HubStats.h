@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_STATS_H
+#define ANDROID_HUB_STATS_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+
+/*****************************************************************************/
+
+// Serve the statistics on HUB_STATS_SOCKET.
+#define MSP430_STATS_PROPERTY "ro.sensors.msp430.stats"
+
+// Abstract unix socket the dump is served on. A client writes "text" or
+// "json" and reads the dump until the HAL closes the connection.
+#define HUB_STATS_SOCKET        "msp430_stats"
+// Time the delivered rate of a sensor is measured over.
+#define HUB_STATS_WINDOW_MS     1000
+// Nesting of the dump a HubStatsWriter keeps track of.
+#define HUB_STATS_DEPTH         4
+
+// What one handle went through, see HubStats::get().
+struct hub_handle_stats {
+    uint32_t records;       // records of its type read from the hub
+    uint32_t events;        // events delivered to the framework
+    uint32_t filtered;      // records skipped undecoded, no client
+    uint32_t discarded;     // records thrown away as suspect
+    uint32_t decimated;     // events thinned to the client rate
+    uint32_t rate_mhz;      // delivered rate over the last full window, mHz
+    uint32_t delay_us;      // rate the client asked for
+};
+
+// Every ioctl made of the hub, see HubStats::getIoctlStats().
+struct hub_ioctl_stats {
+    uint32_t ioctls;
+    uint32_t errors;
+    uint32_t last_error_cmd;    // the latest ioctl that failed, and why
+    uint32_t last_errno;
+};
+
+/*
+ * Builds the dump in memory as indented "name: value" text or as one JSON
+ * object, so what is dumped is spelled out once for both. It is sent in
+ * one go once complete, the peer going away midway can't raise SIGPIPE.
+ */
+class HubStatsWriter {
+public:
+            HubStatsWriter(bool json);
+            ~HubStatsWriter();
+
+    // open a named object, or an unnamed one inside an array
+    void begin(const char* name);
+    void beginArray(const char* name);
+    void end();
+    void endArray();
+    void field(const char* name, int64_t value);
+    void finish();
+
+    const char* data() const { return mBuf; }
+    size_t size() const { return mSize; }
+
+private:
+    void separate();
+    void indent();
+    void append(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    char* mBuf;
+    size_t mSize;
+    size_t mCapacity;
+    bool mJson;
+    int mDepth;
+    bool mFirst[HUB_STATS_DEPTH + 1];
+};
+
+/*
+ * Per-handle counters of the data path, and the thread that serves them
+ * with everything else the HAL counts on HUB_STATS_SOCKET.
+ *
+ * Every counter has a single writer: the data path for the per-handle
+ * ones, the control thread for the rest. An update is a plain store to a
+ * counter nobody else writes, without lock, barrier or atomic
+ * read-modify-write, so counting costs the event path next to nothing.
+ * Readers load the 32 bit counters as they are and may see one a few
+ * updates behind; they never block or slow down the writers.
+ *
+ * A dump is built on the server thread by the handler given to start(),
+ * which is expected to call dumpHandles() and dumpIoctls() along with its
+ * own sections. Only root, system and shell may connect.
+ */
+class HubStats {
+public:
+    typedef void (*dump_t)(void* cookie, HubStatsWriter& w);
+
+            HubStats();
+            ~HubStats();
+
+    int start(dump_t dump, void* cookie);
+    void stop();
+
+    // data path only
+    void record(int handle) { bump(mHandles[handle].records); }
+    void filtered(int handle) { bump(mHandles[handle].filtered); }
+    void discarded(int handle) { bump(mHandles[handle].discarded); }
+    void decimated(int handle) { bump(mHandles[handle].decimated); }
+    void event(int handle, int64_t now);
+
+    // control thread only
+    void setDelay(int handle, int64_t ns);
+    void ioctl(unsigned int cmd, int ret, int err);
+
+    void get(int handle, struct hub_handle_stats* stats) const;
+    void getIoctlStats(struct hub_ioctl_stats* stats) const;
+    void dumpHandles(HubStatsWriter& w, uint32_t clients) const;
+    void dumpIoctls(HubStatsWriter& w) const;
+
+private:
+    struct counters {
+        volatile int32_t records;
+        volatile int32_t events;
+        volatile int32_t filtered;
+        volatile int32_t discarded;
+        volatile int32_t decimated;
+        volatile int32_t rateMhz;
+        volatile int32_t windowMs;  // windowStart in ms, for readers
+        volatile int32_t delayUs;
+        int64_t windowStart;        // data path only, CLOCK_MONOTONIC ns
+        uint32_t windowEvents;
+    };
+
+    static void bump(volatile int32_t& counter) { counter = counter + 1; }
+    static void* threadLoop(void* arg);
+    void serve(int fd);
+
+    struct counters mHandles[SENSORS_NUM_HANDLES];
+    volatile int32_t mIoctls;
+    volatile int32_t mIoctlErrors;
+    volatile int32_t mLastErrorCmd;
+    volatile int32_t mLastErrno;
+
+    dump_t mDump;
+    void* mCookie;
+    int mListenFd;
+    int mStopFd;
+    bool mRunning;
+    pthread_t mThread;
+};
+
+/*
+ * An event of handle delivered to the framework, at CLOCK_MONOTONIC now.
+ * The rate is that of delivery rather than of the event timestamps, which
+ * are hub time when clock sync is off.
+ */
+inline void HubStats::event(int handle, int64_t now)
+{
+    struct counters& c = mHandles[handle];
+
+    bump(c.events);
+    c.windowEvents++;
+    if (now - c.windowStart >= HUB_STATS_WINDOW_MS * 1000000LL) {
+        if (c.windowStart)
+            c.rateMhz = int32_t(c.windowEvents * 1000000000000LL / (now - c.windowStart));
+        c.windowStart = now;
+        c.windowMs = int32_t(now / 1000000);
+        c.windowEvents = 0;
+    }
+}
+
+/*****************************************************************************/
+
+#endif  // ANDROID_HUB_STATS_H
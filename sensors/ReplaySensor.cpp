@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include <cutils/log.h>
+
+#include "ReplaySensor.h"
+
+/*****************************************************************************/
+
+#define RECORD_SIZE sizeof(struct msp430_android_sensor_data)
+
+HubReplay::HubReplay(const char* path, int speed, bool loop)
+    : mTimerFd(-1),
+      mMap(NULL),
+      mMapSize(0),
+      mCaptured(false),
+      mOffset(0),
+      mBlockLeft(0),
+      mPrevTs(0),
+      mHaveCur(false),
+      mDue(0),
+      mSpeed(speed < 0 ? HUB_REPLAY_FAST : speed),
+      mLoop(loop)
+{
+    struct hub_capture_header hdr;
+    struct stat st;
+    void* map;
+    int fd;
+
+    memset(&mCur, 0, sizeof(mCur));
+    memset(&mStats, 0, sizeof(mStats));
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ALOGE_IF(mTimerFd < 0, "Couldn't create replay timerfd (%s)", strerror(errno));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Can't open capture %s (%s)", path, strerror(errno));
+        return;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t)RECORD_SIZE) {
+        ALOGE("Capture %s holds no records", path);
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ALOGE("Can't map capture %s (%s)", path, strerror(errno));
+        return;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    mMap = static_cast<const uint8_t*>(map);
+    mMapSize = st.st_size;
+    memcpy(&hdr, mMap, sizeof(hdr));
+    if (hdr.magic == HUB_CAPTURE_MAGIC) {
+        if (hdr.version != HUB_CAPTURE_VERSION || hdr.record_size != RECORD_SIZE) {
+            ALOGE("Capture %s is version %u, can't replay it", path, hdr.version);
+            munmap(map, mMapSize);
+            mMap = NULL;
+            mMapSize = 0;
+        }
+        mCaptured = true;
+    } else {
+        ALOGE_IF(mMapSize % RECORD_SIZE, "Capture %s ends with a partial record", path);
+    }
+    ALOGD("Replaying %s (%zu bytes) at speed %d", path, mMapSize, mSpeed);
+
+    rewind(SensorBase::getTimestamp());
+    // nothing to start over with
+    if (!mHaveCur)
+        mLoop = false;
+    arm();
+}
+
+HubReplay::~HubReplay()
+{
+    if (mMap)
+        munmap((void*)mMap, mMapSize);
+    if (mTimerFd >= 0)
+        close(mTimerFd);
+}
+
+int HubReplay::ioctl(unsigned int cmd, void* arg)
+{
+    (void)arg;
+    // nothing to answer with, HubSensor keeps its defaults
+    if (_IOC_DIR(cmd) & _IOC_READ) {
+        errno = ENOTTY;
+        return -1;
+    }
+    return 0;
+}
+
+int HubReplay::getFd() const
+{
+    return mTimerFd;
+}
+
+/*
+ * Copy every record that is due and fits into buf.
+ */
+ssize_t HubReplay::read(void* buf, size_t len)
+{
+    struct msp430_android_sensor_data* out =
+            static_cast<struct msp430_android_sensor_data*>(buf);
+    int64_t now = SensorBase::getTimestamp();
+    uint64_t expirations;
+    size_t n = 0;
+
+    // re-armed below, the count itself does not matter
+    ::read(mTimerFd, &expirations, sizeof(expirations));
+
+    while (n < len / RECORD_SIZE) {
+        if (!mHaveCur) {
+            if (!mLoop)
+                break;
+            mStats.loops++;
+            rewind(now);
+        }
+        if (mSpeed != HUB_REPLAY_FAST && mDue > now)
+            break;
+
+        out[n] = mCur;
+        if (mSpeed == HUB_REPLAY_FAST) {
+            out[n].timestamp = now;
+        } else {
+            out[n].timestamp = mDue;
+            if ((now - mDue) / 1000 > mStats.max_late_us)
+                mStats.max_late_us = (now - mDue) / 1000;
+        }
+        n++;
+        advance();
+    }
+
+    arm();
+    if (!n) {
+        errno = EAGAIN;
+        return -1;
+    }
+    mStats.records += n;
+    mStats.reads++;
+    return n * RECORD_SIZE;
+}
+
+/*
+ * Only meaningful from the thread that calls read().
+ */
+void HubReplay::getStats(struct hub_replay_stats* stats) const
+{
+    *stats = mStats;
+}
+
+/*
+ * Decode the record at mOffset into mCur. Returns false at the end of the
+ * records, which in a capture is where the index starts.
+ */
+bool HubReplay::decodeNext()
+{
+    const uint8_t* const end = mMap + mMapSize;
+    int len;
+
+    if (!mCaptured) {
+        if (mMapSize - mOffset < RECORD_SIZE)
+            return false;
+        memcpy(&mCur, mMap + mOffset, RECORD_SIZE);
+        mOffset += RECORD_SIZE;
+        return true;
+    }
+
+    if (!mBlockLeft) {
+        struct hub_capture_block blk;
+
+        if (mMapSize - mOffset < sizeof(blk))
+            return false;
+        // blocks are packed, the header need not be aligned
+        memcpy(&blk, mMap + mOffset, sizeof(blk));
+        if (blk.magic != HUB_CAPTURE_BLOCK_MAGIC || !blk.count ||
+                blk.bytes > mMapSize - mOffset - sizeof(blk))
+            return false;
+        mOffset += sizeof(blk);
+        mBlockLeft = blk.count;
+        mPrevTs = blk.base;
+    }
+
+    len = hub_capture_decode(mMap + mOffset, end, &mPrevTs, &mCur);
+    if (len < 0) {
+        ALOGE("Capture damaged at offset %zu, replay stops", mOffset);
+        return false;
+    }
+    mOffset += len;
+    mBlockLeft--;
+    return true;
+}
+
+void HubReplay::rewind(int64_t now)
+{
+    mOffset = mCaptured ? sizeof(struct hub_capture_header) : 0;
+    mBlockLeft = 0;
+    mHaveCur = mMapSize && decodeNext();
+    mDue = now;
+}
+
+/*
+ * Move on to the next record, due after the recorded gap to it. Gaps that
+ * run backwards (a hub reset in the capture) release it right away.
+ */
+void HubReplay::advance()
+{
+    int64_t prev = mCur.timestamp;
+
+    mHaveCur = decodeNext();
+    if (mHaveCur && mSpeed != HUB_REPLAY_FAST && mCur.timestamp > prev)
+        mDue += (mCur.timestamp - prev) / mSpeed;
+}
+
+/*
+ * Fire when the next record is due: immediately in fast mode or to start
+ * over, never once the capture is done.
+ */
+void HubReplay::arm()
+{
+    struct itimerspec its;
+
+    if (mTimerFd < 0)
+        return;
+    memset(&its, 0, sizeof(its));
+    if (mHaveCur || mLoop) {
+        // an absolute time in the past expires at once
+        int64_t due = mSpeed == HUB_REPLAY_FAST || !mHaveCur ? 1 : mDue;
+        its.it_value.tv_sec = due / 1000000000LL;
+        its.it_value.tv_nsec = due % 1000000000LL;
+    }
+    timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*****************************************************************************/
+
+ReplaySensor::ReplaySensor(const char* path, int speed, bool loop)
+    : HubSensor(new HubReplay(path, speed, loop))
+{
+}
+
+ReplaySensor::~ReplaySensor()
+{
+}
+
+void ReplaySensor::getReplayStats(struct hub_replay_stats* stats) const
+{
+    static_cast<HubReplay*>(getBackend())->getStats(stats);
+}
+
+bool ReplaySensor::finished() const
+{
+    return static_cast<HubReplay*>(getBackend())->finished();
+}
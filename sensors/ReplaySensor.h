@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_REPLAY_SENSOR_H
+#define ANDROID_REPLAY_SENSOR_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "HubBackend.h"
+#include "HubRecorder.h"
+#include "msp430_hal.h"
+
+/*****************************************************************************/
+
+// Replay speed that releases the records as fast as they are read.
+#define HUB_REPLAY_FAST     0
+
+struct hub_replay_stats {
+    uint32_t records;       // records handed to the HAL
+    uint32_t reads;         // read() calls that returned records
+    uint32_t loops;         // times the capture was started over
+    uint32_t max_late_us;   // worst delay between a record being due and read
+};
+
+/*
+ * Serves the msp430_android_sensor_data records of a capture file in place
+ * of the data node. The file is either a raw dump of the data node or a
+ * HubRecorder capture, told apart by its magic; it is mapped, never copied,
+ * and records are decoded one at a time. They are released on a timerfd at
+ * their recorded spacing divided by the speed; HUB_REPLAY_FAST releases
+ * them as fast as the HAL reads. Timestamps are rewritten to the release
+ * time, so the rest of the HAL sees what it would have seen from the hub.
+ * A capture has no control plane: writes to the hub succeed and reads from
+ * it fail with ENOTTY.
+ *
+ * Host only, built into libmsp430_harness: the HAL on the device never
+ * serves anything but the hub.
+ */
+class HubReplay : public HubBackend {
+public:
+            HubReplay(const char* path, int speed, bool loop);
+    virtual ~HubReplay();
+
+    virtual int ioctl(unsigned int cmd, void* arg);
+    virtual int getFd() const;
+    virtual ssize_t read(void* buf, size_t len);
+
+    void getStats(struct hub_replay_stats* stats) const;
+    // every record has been read and none is coming again
+    bool finished() const { return !mHaveCur && !mLoop; }
+
+private:
+    bool decodeNext();
+    void rewind(int64_t now);
+    void advance();
+    void arm();
+
+    int mTimerFd;
+    const uint8_t* mMap;
+    size_t mMapSize;
+    bool mCaptured;         // a HubRecorder capture rather than a raw dump
+    size_t mOffset;         // where the record after mCur starts
+    uint32_t mBlockLeft;    // records of the current capture block after mCur
+    int64_t mPrevTs;        // what the next capture record is relative to
+    struct msp430_android_sensor_data mCur;
+    bool mHaveCur;          // false once the capture is done
+    int64_t mDue;           // CLOCK_MONOTONIC release time of mCur
+    int mSpeed;
+    bool mLoop;
+    struct hub_replay_stats mStats;
+};
+
+/*
+ * HubSensor fed from a capture file, see HubReplay.
+ */
+class ReplaySensor : public HubSensor {
+public:
+            ReplaySensor(const char* path, int speed, bool loop);
+    virtual ~ReplaySensor();
+
+    void getReplayStats(struct hub_replay_stats* stats) const;
+    bool finished() const;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_REPLAY_SENSOR_H
@@ -35,7 +35,6 @@ protected:
     int         data_fd;
 
     static int openInput(const char* inputName);
-    static int64_t getTimestamp();
 
 
     static int64_t timevalToNano(timeval const& t) {
@@ -46,6 +45,9 @@ protected:
     int close_device();
 
 public:
+    // CLOCK_MONOTONIC in ns, the clock of event timestamps and of the HAL's timers
+    static int64_t getTimestamp();
+
             SensorBase(
                     const char* dev_name,
                     const char* data_name);
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <cutils/log.h>
+
+#include "SensorFifo.h"
+
+/*****************************************************************************/
+
+SensorFifo::SensorFifo(int capacity)
+    : mEvents(NULL),
+      mCapacity(capacity),
+      mHead(0),
+      mCount(0),
+      mOldest(0),
+      mDropped(0)
+{
+    mEvents = new sensors_event_t[capacity];
+}
+
+SensorFifo::~SensorFifo()
+{
+    delete[] mEvents;
+}
+
+void SensorFifo::push(sensors_event_t const& event, int64_t now)
+{
+    if (mCount == mCapacity) {
+        // overwrite the oldest event, as a hardware FIFO would
+        mHead = (mHead + 1) % mCapacity;
+        mCount--;
+        mDropped++;
+    }
+    if (mCount == 0)
+        mOldest = now;
+    mEvents[(mHead + mCount) % mCapacity] = event;
+    mCount++;
+}
+
+int SensorFifo::pop(sensors_event_t* data, int count)
+{
+    int n = 0;
+
+    while (mCount && n < count) {
+        data[n++] = mEvents[mHead];
+        mHead = (mHead + 1) % mCapacity;
+        mCount--;
+    }
+    return n;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_FIFO_H
+#define ANDROID_SENSOR_FIFO_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <hardware/sensors.h>
+
+/*****************************************************************************/
+
+/*
+ * Per-sensor batching FIFO kept by the HAL. Events are held until the
+ * sensor's max_report_latency expires, the FIFO runs three quarters full or
+ * a flush is requested. Like a hardware FIFO it drops the oldest event if it
+ * does overflow.
+ */
+class SensorFifo {
+public:
+            SensorFifo(int capacity);
+            ~SensorFifo();
+
+    void push(sensors_event_t const& event, int64_t now);
+    int pop(sensors_event_t* data, int count);
+
+    bool empty() const { return mCount == 0; }
+    bool nearlyFull() const { return mCount >= mCapacity - mCapacity / 4; }
+    int64_t oldest() const { return mOldest; }
+    uint32_t dropped() const { return mDropped; }
+
+private:
+    sensors_event_t* mEvents;
+    int mCapacity;
+    int mHead;
+    int mCount;
+    int64_t mOldest;        // CLOCK_MONOTONIC when the oldest event was queued
+    uint32_t mDropped;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_FIFO_H
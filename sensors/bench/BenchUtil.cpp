@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <cutils/atomic.h>
+
+#include "BenchUtil.h"
+#include "HubProfiler.h"
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+int64_t bench_now_ns()
+{
+    return SensorBase::getTimestamp();
+}
+
+void bench_sleep_until(int64_t ns)
+{
+    struct timespec t;
+
+    t.tv_sec = ns / 1000000000LL;
+    t.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+        ;
+}
+
+#define TYPE_NAME(type) case type: return #type;
+
+const char* bench_type_name(int type)
+{
+    switch (type) {
+    TYPE_NAME(DT_ACCEL)
+    TYPE_NAME(DT_GYRO)
+    TYPE_NAME(DT_PRESSURE)
+    TYPE_NAME(DT_MAG)
+    TYPE_NAME(DT_ORIENT)
+    TYPE_NAME(DT_TEMP)
+    TYPE_NAME(DT_ALS)
+    TYPE_NAME(DT_LIN_ACCEL)
+    TYPE_NAME(DT_QUATERNION)
+    TYPE_NAME(DT_GRAVITY)
+    TYPE_NAME(DT_DISP_ROTATE)
+    TYPE_NAME(DT_DISP_BRIGHT)
+    TYPE_NAME(DT_DOCK)
+    TYPE_NAME(DT_PROX)
+    TYPE_NAME(DT_FLAT_UP)
+    TYPE_NAME(DT_FLAT_DOWN)
+    TYPE_NAME(DT_STOWED)
+    TYPE_NAME(DT_MMMOVE)
+    TYPE_NAME(DT_NOMOVE)
+    TYPE_NAME(DT_CAMERA_ACT)
+    TYPE_NAME(DT_NFC)
+    TYPE_NAME(DT_ALGO_EVT)
+    TYPE_NAME(DT_ACCUM_MVMT)
+    TYPE_NAME(DT_SIM)
+    TYPE_NAME(DT_RESET)
+    TYPE_NAME(DT_GENERIC_INT)
+    TYPE_NAME(DT_STEP_COUNTER)
+    TYPE_NAME(DT_STEP_DETECTOR)
+    }
+    return "DT_?";
+}
+
+/*****************************************************************************/
+
+BenchCycles::BenchCycles()
+    : mFd(HubProfiler::openCounter())
+{
+}
+
+BenchCycles::~BenchCycles()
+{
+    if (mFd >= 0)
+        close(mFd);
+}
+
+uint64_t BenchCycles::read() const
+{
+    uint64_t count = 0;
+
+    if (mFd >= 0 && ::read(mFd, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    return count;
+}
+
+/*****************************************************************************/
+
+BenchStamps::BenchStamps()
+    : mCount(0)
+{
+    memset(mStamps, 0, sizeof(mStamps));
+}
+
+void BenchStamps::add(int64_t ts)
+{
+    mStamps[mCount % BENCH_STAMPS] = ts;
+    android_atomic_release_store(mCount + 1, &mCount);
+}
+
+uint32_t BenchStamps::count() const
+{
+    return android_atomic_acquire_load(&mCount);
+}
+
+int64_t BenchStamps::find(int64_t ts, int64_t slack) const
+{
+    uint32_t count = android_atomic_acquire_load(&mCount);
+    // keep clear of the slots the writer may be reusing meanwhile
+    uint32_t lo = count > BENCH_STAMPS / 2 ? count - BENCH_STAMPS / 2 : 0;
+    uint32_t hi = count;
+    int64_t best = -1;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (at(mid) < ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint32_t seq = lo ? lo - 1 : 0; seq <= lo && seq < count; seq++) {
+        int64_t d = at(seq) - ts;
+        if (d < 0)
+            d = -d;
+        if (d < slack) {
+            slack = d;
+            best = seq;
+        }
+    }
+    return best;
+}
+
+/*****************************************************************************/
+
+PipeBackend::PipeBackend(BenchCycles const* cycles)
+    : readNs(0),
+      readCycles(0),
+      readCalls(0),
+      mCycles(cycles),
+      mReadFd(-1),
+      mWriteFd(-1)
+{
+    int fds[2];
+
+    if (pipe(fds)) {
+        fprintf(stderr, "pipe() failed (%s)\n", strerror(errno));
+        return;
+    }
+    mReadFd = fds[0];
+    mWriteFd = fds[1];
+    fcntl(mReadFd, F_SETFL, O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+    fcntl(mWriteFd, F_SETPIPE_SZ, BENCH_PIPE_SIZE);
+#endif
+}
+
+PipeBackend::~PipeBackend()
+{
+    closeWriter();
+    if (mReadFd >= 0)
+        close(mReadFd);
+}
+
+int PipeBackend::ioctl(unsigned int cmd, void* arg)
+{
+    (void)arg;
+    if (_IOC_DIR(cmd) & _IOC_READ) {
+        errno = ENOTTY;
+        return -1;
+    }
+    return 0;
+}
+
+int PipeBackend::getFd() const
+{
+    return mReadFd;
+}
+
+ssize_t PipeBackend::read(void* buf, size_t len)
+{
+    uint64_t c0 = mCycles ? mCycles->read() : 0;
+    int64_t t0 = bench_now_ns();
+    ssize_t ret = ::read(mReadFd, buf, len);
+    int err = errno;
+
+    readNs += bench_now_ns() - t0;
+    if (mCycles)
+        readCycles += mCycles->read() - c0;
+    readCalls++;
+    // the pipe being done looks like an empty data node to the HAL
+    if (ret == 0) {
+        ret = -1;
+        err = EAGAIN;
+    }
+    errno = err;
+    return ret;
+}
+
+void PipeBackend::closeWriter()
+{
+    if (mWriteFd >= 0)
+        close(mWriteFd);
+    mWriteFd = -1;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BENCH_UTIL_H
+#define ANDROID_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "HubBackend.h"
+#include "hub_sensors.h"
+
+/*****************************************************************************/
+
+// Bytes the feeding pipe holds, so the writer runs ahead of the HAL.
+#define BENCH_PIPE_SIZE     (1 << 20)
+// Injections of one sensor BenchStamps remembers.
+#define BENCH_STAMPS        4096
+
+int64_t bench_now_ns();
+void bench_sleep_until(int64_t ns);
+
+// Name of a DT_* record type, "DT_?" for one this tree does not know.
+const char* bench_type_name(int type);
+
+/*
+ * CPU cycles spent by the calling thread, from the counter the stage
+ * profiler uses. valid() is false where the kernel does not allow it,
+ * read() then returns 0.
+ */
+class BenchCycles {
+public:
+            BenchCycles();
+            ~BenchCycles();
+
+    bool valid() const { return mFd >= 0; }
+    uint64_t read() const;
+
+private:
+    int mFd;
+};
+
+/*
+ * When each record of one sensor was injected, by sequence number, for the
+ * last BENCH_STAMPS of them. Injected records carry that time as their hub
+ * timestamp and the HAL maps hub time onto CLOCK_MONOTONIC, which for them
+ * is the identity give or take the transit time its clock fit settles on;
+ * find() so tells which record an event came from. One thread adds, any
+ * thread may find; a stamp is published before its record is written.
+ */
+class BenchStamps {
+public:
+            BenchStamps();
+
+    void add(int64_t ts);
+    uint32_t count() const;
+    int64_t at(uint32_t seq) const { return mStamps[seq % BENCH_STAMPS]; }
+    // sequence number of the stamp nearest ts, -1 if none is within slack
+    int64_t find(int64_t ts, int64_t slack) const;
+
+private:
+    int64_t mStamps[BENCH_STAMPS];
+    volatile int32_t mCount;
+};
+
+/*
+ * A HubBackend fed through a pipe: whatever is written to writeFd() comes
+ * out of read() as the data node would return it. The time and cycles
+ * spent in read() are added up, so callers can tell the read stage from
+ * the decode stage. Hub writes succeed, hub reads fail with ENOTTY.
+ */
+class PipeBackend : public HubBackend {
+public:
+            PipeBackend(BenchCycles const* cycles);
+    virtual ~PipeBackend();
+
+    virtual int ioctl(unsigned int cmd, void* arg);
+    virtual int getFd() const;
+    virtual ssize_t read(void* buf, size_t len);
+
+    int writeFd() const { return mWriteFd; }
+    void closeWriter();
+
+    uint64_t readNs;
+    uint64_t readCycles;
+    uint64_t readCalls;
+
+private:
+    BenchCycles const* mCycles;
+    int mReadFd;
+    int mWriteFd;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_BENCH_UTIL_H
@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost of the reconfiguration bursts the phone goes through on screen on
+ * and off, calls and the camera: the activate()/setDelay() calls the
+ * framework makes on the poll device and the algo requests the modality
+ * manager makes of the sensorhub module. The poll device is opened over a
+ * HubEmulator whose control ioctls each take a set time, like the I2C
+ * transaction behind them; a poll thread drains events meanwhile like the
+ * framework's does. The sensorhub module is opened over the same emulator
+ * through sensorhub_open_io(), its lock and request cache included, and a
+ * second thread polls it like the modality manager. The module's own path
+ * to the driver, ioctl(2) on its control fd, is first checked over
+ * /dev/null. Prints one JSON object:
+ *
+ *   { "bench": "control", "ioctl_us": L, "repeats": R,
+ *     "results": [ { "scenario", "calls", "ioctls", "wall_us_mean",
+ *                    "wall_us_max", "us_per_call", "settle_us_mean",
+ *                    "settle_us_max" }, ... ] }
+ *
+ * "wall" is the time the callers were blocked in the burst, "settle" the
+ * time until its last ioctl reached the hub, which takes in the HAL's
+ * transaction window. "ioctls" is the mean number of hub ioctls a burst
+ * took.
+ *
+ * usage: msp430_control_bench [-l ioctl latency in us] [-r repeats]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <hardware/mot_sensorhub_msp430.h>
+
+#include "nusensors.h"
+#include "msp430_hal.h"
+#include "sensorhub_io.h"
+#include "HubEmulator.h"
+#include "BenchUtil.h"
+
+extern "C" struct sensors_module_t HAL_MODULE_INFO_SYM;
+// sensorhub.c, built with its module renamed
+extern "C" struct hw_module_t SENSORHUB_MODULE_SYM;
+
+/*****************************************************************************/
+
+// a transaction on the hub's I2C bus, give or take
+#define DEFAULT_IOCTL_US    500
+#define DEFAULT_REPEATS     20
+#define POLL_EVENTS         64
+// Quiet time after the transaction window before a burst is taken as done.
+#define SETTLE_QUIET_NS     10000000LL
+#define MAX_STEPS           16
+
+// durations of each part of an algo request, in s
+#define ALGO_START_S        5
+#define ALGO_END_S          5
+// SENSORHUB_ALGO_MOVEMENT parameters, in s
+#define MOTION_DUR_S        60
+#define ZRMOTION_DUR_S      30
+
+// SENSOR_DELAY_* in ns
+#define DELAY_GAME          20000000LL
+#define DELAY_UI            66667000LL
+#define DELAY_NORMAL        200000000LL
+
+enum {
+    OP_END = 0,
+    OP_ACTIVATE,        // poll__activate(arg, 1)
+    OP_DEACTIVATE,      // poll__activate(arg, 0)
+    OP_SET_DELAY,       // poll__setDelay(arg, value)
+    OP_ALGO_REQ,        // sensorhub algo_req(arg, value active parts)
+    OP_MOVEMENT,        // sensorhub enable(SENSORHUB_ALGO_MOVEMENT, arg)
+};
+
+struct step {
+    int op;
+    int arg;
+    int64_t value;
+};
+
+struct burst {
+    const char* name;
+    struct step steps[MAX_STEPS];
+};
+
+/*
+ * Run in this order, each burst leaves the state the next one expects:
+ * the orientation listener and auto brightness come with the screen, the
+ * proximity and stowed detection with a call, and the camera app speeds
+ * the motion sensors up on top of the screen being on.
+ */
+static const struct burst bursts[] = {
+    { "screen_on", {
+        { OP_SET_DELAY, ID_A, DELAY_UI },
+        { OP_ACTIVATE, ID_A, 0 },
+        { OP_SET_DELAY, ID_L, DELAY_NORMAL },
+        { OP_ACTIVATE, ID_L, 0 },
+        { OP_ACTIVATE, ID_DB, 0 },
+        { OP_ACTIVATE, ID_DR, 0 },
+        { OP_ALGO_REQ, SENSORHUB_ALGO_ORIENTATION, 0xf },
+        { OP_END, 0, 0 } } },
+    { "call_start", {
+        { OP_ACTIVATE, ID_P, 0 },
+        { OP_DEACTIVATE, ID_DR, 0 },
+        { OP_ACTIVATE, ID_S, 0 },
+        { OP_ALGO_REQ, SENSORHUB_ALGO_STOWED, 0x7 },
+        { OP_END, 0, 0 } } },
+    { "call_end", {
+        { OP_DEACTIVATE, ID_P, 0 },
+        { OP_DEACTIVATE, ID_S, 0 },
+        { OP_ACTIVATE, ID_DR, 0 },
+        { OP_ALGO_REQ, SENSORHUB_ALGO_STOWED, 0 },
+        { OP_END, 0, 0 } } },
+    { "camera_start", {
+        { OP_SET_DELAY, ID_A, DELAY_GAME },
+        { OP_SET_DELAY, ID_G, DELAY_GAME },
+        { OP_ACTIVATE, ID_G, 0 },
+        { OP_SET_DELAY, ID_M, DELAY_GAME },
+        { OP_ACTIVATE, ID_M, 0 },
+        { OP_SET_DELAY, ID_Q, DELAY_GAME },
+        { OP_ACTIVATE, ID_Q, 0 },
+        { OP_MOVEMENT, 1, 0 },
+        { OP_END, 0, 0 } } },
+    { "camera_stop", {
+        { OP_DEACTIVATE, ID_Q, 0 },
+        { OP_DEACTIVATE, ID_M, 0 },
+        { OP_DEACTIVATE, ID_G, 0 },
+        { OP_SET_DELAY, ID_A, DELAY_UI },
+        { OP_MOVEMENT, 0, 0 },
+        { OP_END, 0, 0 } } },
+    { "screen_off", {
+        { OP_DEACTIVATE, ID_DR, 0 },
+        { OP_DEACTIVATE, ID_DB, 0 },
+        { OP_DEACTIVATE, ID_L, 0 },
+        { OP_DEACTIVATE, ID_A, 0 },
+        { OP_ALGO_REQ, SENSORHUB_ALGO_ORIENTATION, 0 },
+        { OP_END, 0, 0 } } },
+};
+
+#define NUM_BURSTS (sizeof(bursts) / sizeof(bursts[0]))
+
+struct bench {
+    sensors_poll_device_1_t* dev;
+    sensors_poll_device_t* v0;  // the same device, as activate() and poll() take it
+    sensorhub_device_t* shdev;
+    HubEmulator* hub;
+    volatile int32_t done;
+    int64_t quiet;              // no ioctl for this long ends a burst
+};
+
+struct result {
+    uint32_t calls;
+    uint64_t ioctls;
+    int64_t total;
+    int64_t max;
+    int64_t settleTotal;
+    int64_t settleMax;
+};
+
+// The modality manager's requests, each part held as long as the last.
+static int algo_req(struct bench* b, uint16_t algo, uint32_t parts)
+{
+    struct sensorhub_req_t req[SENSORHUB_NUM_MODALITIES];
+
+    memset(req, 0, sizeof(req));
+    for (int i = 0; i < SENSORHUB_NUM_MODALITIES; i++) {
+        req[i].start_dur_s = ALGO_START_S;
+        req[i].end_dur_s = ALGO_END_S;
+    }
+    return b->shdev->algo_req(b->shdev, algo, parts, req);
+}
+
+static int movement(struct bench* b, bool enable)
+{
+    struct sensorhub_algo_t algo;
+
+    memset(&algo, 0, sizeof(algo));
+    algo.type = SENSORHUB_ALGO_MOVEMENT;
+    algo.enable = enable;
+    algo.parameter[0] = MOTION_DUR_S;
+    algo.parameter[1] = ZRMOTION_DUR_S;
+    return b->shdev->enable(b->shdev, &algo);
+}
+
+/*
+ * The module's requests through ioctl(2) on control_fd, here /dev/null:
+ * each has to come back with its ENOTTY.
+ */
+static int check_driver_path()
+{
+    struct sensorhub_io_t io;
+    struct bench b;
+    hw_device_t* device;
+    int fd, ret;
+
+    fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    memset(&io, 0, sizeof(io));
+    io.fd = fd;
+    io.control_fd = fd;
+    ret = sensorhub_open_io(&SENSORHUB_MODULE_SYM, &io, &device);
+    if (ret) {
+        close(fd);
+        return ret;
+    }
+    memset(&b, 0, sizeof(b));
+    b.shdev = (sensorhub_device_t*)device;
+    ret = algo_req(&b, SENSORHUB_ALGO_ORIENTATION, 0xf);
+    if (ret == -ENOTTY)
+        ret = movement(&b, true);
+    device->close(device);
+    close(fd);
+    return ret == -ENOTTY ? 0 : ret ? ret : -EINVAL;
+}
+
+static int run_step(struct bench* b, struct step const& s)
+{
+    switch (s.op) {
+    case OP_ACTIVATE:
+        return b->dev->activate(b->v0, s.arg, 1);
+    case OP_DEACTIVATE:
+        return b->dev->activate(b->v0, s.arg, 0);
+    case OP_SET_DELAY:
+        return b->dev->setDelay(b->v0, s.arg, s.value);
+    case OP_ALGO_REQ:
+        return algo_req(b, s.arg, s.value);
+    case OP_MOVEMENT:
+        return movement(b, s.arg != 0);
+    }
+    return -EINVAL;
+}
+
+static int run_burst(struct bench* b, struct burst const& burst, struct result* r)
+{
+    struct hub_emulator_stats before, after;
+    int64_t start, wall, settle, end;
+    int err = 0;
+
+    b->hub->getStats(&before);
+    start = bench_now_ns();
+    for (int i = 0; i < MAX_STEPS && burst.steps[i].op != OP_END; i++) {
+        int ret = run_step(b, burst.steps[i]);
+        if (ret && !err) {
+            fprintf(stderr, "%s: step %d failed (%s)\n", burst.name, i, strerror(-ret));
+            err = ret;
+        }
+        r->calls++;
+    }
+    end = bench_now_ns();
+    wall = end - start;
+
+    // whatever the HAL deferred goes out once its window closes
+    for (;;) {
+        b->hub->getStats(&after);
+        int64_t last = after.last_ioctl_ns > end ? after.last_ioctl_ns : end;
+        if (bench_now_ns() - last >= b->quiet)
+            break;
+        usleep(1000);
+    }
+    settle = (after.last_ioctl_ns > end ? after.last_ioctl_ns : end) - start;
+
+    r->ioctls += after.ioctls - before.ioctls;
+    r->total += wall;
+    if (wall > r->max)
+        r->max = wall;
+    r->settleTotal += settle;
+    if (settle > r->settleMax)
+        r->settleMax = settle;
+    return err;
+}
+
+/*
+ * The framework's poll thread. It keeps the HAL's view of the streams
+ * current, so the stall watchdog has no reason to step in.
+ */
+static void* drain(void* arg)
+{
+    struct bench* b = static_cast<struct bench*>(arg);
+    sensors_event_t events[POLL_EVENTS];
+
+    for (;;) {
+        int n = b->dev->poll(b->v0, events, POLL_EVENTS);
+        if (n < 0)
+            break;
+        for (int i = 0; i < n; i++) {
+            if (events[i].type == SENSOR_TYPE_META_DATA &&
+                    events[i].meta_data.what == META_DATA_FLUSH_COMPLETE &&
+                    android_atomic_acquire_load(&b->done))
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The modality manager's poll thread, so the motion node doesn't back up.
+ * A hub reset wakes it to be told to stop.
+ */
+static void* drain_sensorhub(void* arg)
+{
+    struct bench* b = static_cast<struct bench*>(arg);
+    struct sensorhub_event_t event;
+
+    for (;;) {
+        int n = b->shdev->poll(b->shdev, &event);
+        if (n < 0)
+            break;
+        if (n > 0 && event.type == SENSORHUB_EVENT_RESET &&
+                android_atomic_acquire_load(&b->done))
+            break;
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    static struct result results[NUM_BURSTS];
+    struct bench b;
+    hw_device_t* device;
+    hw_device_t* shdevice;
+    struct sensorhub_io_t io;
+    pthread_t thread, shthread;
+    uint32_t ioctl_us = DEFAULT_IOCTL_US;
+    int repeats = DEFAULT_REPEATS;
+    int err = 0;
+    int opt;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "l:r:")) != -1) {
+        switch (opt) {
+        case 'l':
+            ioctl_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l ioctl_us] [-r repeats]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (repeats < 1)
+        return 2;
+
+    err = check_driver_path();
+    if (err) {
+        fprintf(stderr, "sensorhub driver path failed (%s)\n", strerror(-err));
+        return 1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    char value[PROPERTY_VALUE_MAX];
+    property_get(MSP430_TXN_WINDOW_PROPERTY, value, "5");
+    b.quiet = atoi(value) * 1000000LL + ioctl_us * 1000LL + SETTLE_QUIET_NS;
+    b.hub = new HubEmulator();
+    b.hub->setIoctlLatency(ioctl_us);
+    if (init_nusensors_backend(&HAL_MODULE_INFO_SYM.common, b.hub, &device)) {
+        delete b.hub;
+        return 1;
+    }
+    b.dev = (sensors_poll_device_1_t*)device;
+    b.v0 = (sensors_poll_device_t*)device;
+    b.hub->getSensorhubIo(&io);
+    if (sensorhub_open_io(&SENSORHUB_MODULE_SYM, &io, &shdevice)) {
+        device->close(device);
+        return 1;
+    }
+    b.shdev = (sensorhub_device_t*)shdevice;
+    if (pthread_create(&shthread, NULL, drain_sensorhub, &b)) {
+        shdevice->close(shdevice);
+        device->close(device);
+        return 1;
+    }
+    if (pthread_create(&thread, NULL, drain, &b)) {
+        android_atomic_release_store(1, &b.done);
+        b.hub->reset();
+        pthread_join(shthread, NULL);
+        shdevice->close(shdevice);
+        device->close(device);
+        return 1;
+    }
+
+    // one untimed round, so the HAL's start up work is out of the way
+    struct result warmup[NUM_BURSTS];
+    memset(warmup, 0, sizeof(warmup));
+    for (i = 0; i < NUM_BURSTS; i++)
+        err |= run_burst(&b, bursts[i], &warmup[i]);
+
+    for (int n = 0; n < repeats; n++) {
+        for (i = 0; i < NUM_BURSTS; i++)
+            err |= run_burst(&b, bursts[i], &results[i]);
+    }
+
+    // the accelerometer is flushed to get the poll thread out
+    android_atomic_release_store(1, &b.done);
+    b.dev->activate(b.v0, ID_A, 1);
+    b.dev->flush(b.dev, ID_A);
+    pthread_join(thread, NULL);
+    b.dev->activate(b.v0, ID_A, 0);
+    // and a hub reset the sensorhub one
+    b.hub->reset();
+    pthread_join(shthread, NULL);
+    shdevice->close(shdevice);
+    device->close(device);
+
+    printf("{\n");
+    printf("  \"bench\": \"control\",\n");
+    printf("  \"ioctl_us\": %u,\n", ioctl_us);
+    printf("  \"repeats\": %d,\n", repeats);
+    printf("  \"results\": [\n");
+    for (i = 0; i < NUM_BURSTS; i++) {
+        struct result const& r = results[i];
+        printf("    { \"scenario\": \"%s\", \"calls\": %u, \"ioctls\": %.1f, "
+                "\"wall_us_mean\": %.1f, \"wall_us_max\": %.1f, "
+                "\"us_per_call\": %.1f, \"settle_us_mean\": %.1f, "
+                "\"settle_us_max\": %.1f }%s\n",
+                bursts[i].name, r.calls / repeats, (double)r.ioctls / repeats,
+                r.total / 1000.0 / repeats, r.max / 1000.0,
+                r.calls ? r.total / 1000.0 / r.calls : 0.0,
+                r.settleTotal / 1000.0 / repeats, r.settleMax / 1000.0,
+                i == NUM_BURSTS - 1 ? "" : ",");
+    }
+    printf("  ]\n}\n");
+    return err ? 1 : 0;
+}
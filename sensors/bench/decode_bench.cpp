@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decode throughput of HubSensor::readEvents(), per record type and for a
+ * mix like the one the phone sees with the motion sensors running.
+ * Records are written to a pipe by a feeder thread and read back through
+ * PipeBackend, so the data path is the same as on the device short of the
+ * driver. Prints one JSON object:
+ *
+ *   { "bench": "decode", "records": N, "batch": B, "cycles": true|false,
+ *     "results": [ { "mix", "records", "events", "events_per_s",
+ *                    "ns_per_event", "stages": { "poll", "read",
+ *                    "decode" } }, ... ] }
+ *
+ * where each stage has "ns_per_record" and "cycles_per_record".
+ *
+ * usage: msp430_decode_bench [-n records] [-b events per readEvents()]
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msp430_hal.h"
+#include "HubEmulator.h"
+#include "BenchUtil.h"
+
+/*****************************************************************************/
+
+#define DEFAULT_RECORDS     200000
+#define DEFAULT_BATCH       64
+#define MAX_MIX             4
+// Rate the sensors are set to and the spacing of their records, fast
+// enough that nothing is decimated.
+#define BENCH_DELAY_NS      1000000LL
+// Records per write() of the feeder.
+#define FEED_CHUNK          256
+
+struct bench_mix {
+    const char* name;
+    int handles[MAX_MIX];
+    int count;
+};
+
+struct feeder {
+    PipeBackend* backend;
+    struct bench_mix const* mix;
+    uint32_t records;
+};
+
+struct stage {
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+/*
+ * Writes the records of the mix round robin, each type at BENCH_DELAY_NS
+ * of hub time from the previous one of its kind.
+ */
+static void* feed(void* arg)
+{
+    struct feeder* f = static_cast<struct feeder*>(arg);
+    struct msp430_android_sensor_data chunk[FEED_CHUNK];
+    int64_t ts = 1000000000LL;
+    uint32_t n = 0;
+
+    while (n < f->records) {
+        uint32_t count = f->records - n < FEED_CHUNK ? f->records - n : FEED_CHUNK;
+        for (uint32_t i = 0; i < count; i++, n++) {
+            int handle = f->mix->handles[n % f->mix->count];
+            if (n % f->mix->count == 0)
+                ts += BENCH_DELAY_NS;
+            HubEmulator::fillRecord(&chunk[i], hub_sensors[handle].dt,
+                    n / f->mix->count, ts);
+        }
+        const char* p = (const char*)chunk;
+        size_t left = count * sizeof(chunk[0]);
+        while (left) {
+            ssize_t ret = write(f->backend->writeFd(), p, left);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "feeder write() failed (%s)\n", strerror(errno));
+                return NULL;
+            }
+            p += ret;
+            left -= ret;
+        }
+    }
+    f->backend->closeWriter();
+    return NULL;
+}
+
+static void print_stage(const char* name, struct stage const& s, uint32_t records,
+        bool last)
+{
+    printf("        \"%s\": { \"ns_per_record\": %.1f, \"cycles_per_record\": %.1f }%s\n",
+            name, (double)s.ns / records, (double)s.cycles / records, last ? "" : ",");
+}
+
+static int run_mix(struct bench_mix const& mix, uint32_t records, int batch,
+        BenchCycles const& cycles, bool first)
+{
+    PipeBackend* backend = new PipeBackend(&cycles);
+    HubSensor* hub = new HubSensor(backend);
+    sensors_event_t* events = new sensors_event_t[batch];
+    struct stage poll_stage = { 0, 0 }, total = { 0, 0 }, read_stage, decode_stage;
+    struct hub_read_stats rs;
+    struct feeder f = { backend, &mix, records };
+    pthread_t thread;
+    uint64_t nevents = 0;
+    int64_t start, elapsed;
+    int err = 0;
+
+    for (int i = 0; i < mix.count; i++) {
+        hub->setDelay(mix.handles[i], BENCH_DELAY_NS);
+        hub->enable(mix.handles[i], 1);
+    }
+    if (pthread_create(&thread, NULL, feed, &f)) {
+        delete[] events;
+        delete hub;
+        return -1;
+    }
+
+    start = bench_now_ns();
+    for (;;) {
+        struct pollfd pfd = { hub->getFd(), POLLIN, 0 };
+        uint64_t c0;
+        int64_t t0;
+        int n;
+
+        hub->getReadStats(&rs);
+        if (rs.records >= records && !hub->hasPendingEvents())
+            break;
+
+        c0 = cycles.read();
+        t0 = bench_now_ns();
+        n = poll(&pfd, 1, 1000);
+        poll_stage.ns += bench_now_ns() - t0;
+        poll_stage.cycles += cycles.read() - c0;
+        if (n <= 0) {
+            fprintf(stderr, "%s: no data after %u records\n", mix.name, rs.records);
+            err = -1;
+            break;
+        }
+
+        c0 = cycles.read();
+        t0 = bench_now_ns();
+        n = hub->readEvents(events, batch);
+        total.ns += bench_now_ns() - t0;
+        total.cycles += cycles.read() - c0;
+        if (n > 0)
+            nevents += n;
+    }
+    elapsed = bench_now_ns() - start;
+    pthread_join(thread, NULL);
+
+    read_stage.ns = backend->readNs;
+    read_stage.cycles = backend->readCycles;
+    decode_stage.ns = total.ns - read_stage.ns;
+    decode_stage.cycles = total.cycles - read_stage.cycles;
+
+    printf("%s    {\n", first ? "" : ",\n");
+    printf("      \"mix\": \"%s\",\n", mix.name);
+    printf("      \"records\": %u,\n", rs.records);
+    printf("      \"events\": %llu,\n", (unsigned long long)nevents);
+    printf("      \"events_per_s\": %.0f,\n", nevents * 1e9 / elapsed);
+    printf("      \"ns_per_event\": %.1f,\n", nevents ? (double)elapsed / nevents : 0.0);
+    printf("      \"stages\": {\n");
+    print_stage("poll", poll_stage, records, false);
+    print_stage("read", read_stage, records, false);
+    print_stage("decode", decode_stage, records, true);
+    printf("      }\n");
+    printf("    }");
+
+    delete[] events;
+    delete hub;
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_mix mixes[SENSORS_NUM_HANDLES + 1];
+    struct bench_mix motion = {
+        "motion", { ID_A, ID_G, ID_M, ID_O }, 4
+    };
+    uint32_t records = DEFAULT_RECORDS;
+    int batch = DEFAULT_BATCH;
+    int nmix = 0, err = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch (opt) {
+        case 'n':
+            records = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n records] [-b batch]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!records || batch < 1)
+        return 2;
+
+    // every record type a sensor decodes, one at a time
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        struct hub_sensor const& desc = hub_sensors[handle];
+        if (desc.dt == HUB_DT_NONE || desc.bank == HUB_BANK_NONE ||
+                desc.decoder == HUB_DECODE_NONE || (desc.flags & HUB_F_ONE_SHOT))
+            continue;
+        mixes[nmix].name = bench_type_name(desc.dt);
+        mixes[nmix].handles[0] = handle;
+        mixes[nmix].count = 1;
+        nmix++;
+    }
+    mixes[nmix++] = motion;
+
+    BenchCycles cycles;
+    printf("{\n");
+    printf("  \"bench\": \"decode\",\n");
+    printf("  \"records\": %u,\n", records);
+    printf("  \"batch\": %d,\n", batch);
+    printf("  \"cycles\": %s,\n", cycles.valid() ? "true" : "false");
+    printf("  \"results\": [\n");
+    for (int i = 0; i < nmix; i++)
+        err |= run_mix(mixes[i], records, batch, cycles, i == 0);
+    printf("\n  ]\n}\n");
+    return err ? 1 : 0;
+}
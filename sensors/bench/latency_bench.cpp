@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * End to end delivery latency of the HAL: from a record entering the data
+ * node to its event coming out of the poll device, the way the framework's
+ * poll thread sees it. The device is opened through the module like on the
+ * phone, with a PipeBackend in place of the driver. An injector thread
+ * writes each record stamped with CLOCK_MONOTONIC at the moment it is
+ * written; the event carrying that timestamp is matched back to it when
+ * poll() returns. Prints one JSON object:
+ *
+ *   { "bench": "latency", "seconds": S,
+ *     "results": [ { "scenario", "sensors": [ { "handle", "name", "wake",
+ *                    "injected", "delivered", "unmatched", "p50_us",
+ *                    "p99_us", "p999_us", "max_us" }, ... ] }, ... ] }
+ *
+ * Scenarios: "light" is the accelerometer at SENSOR_DELAY_GAME, "max" every
+ * streaming sensor at its minDelay, "wakeup" the wake-up sensors at random
+ * intervals over the accelerometer at its minDelay. Wake-up sensors are
+ * marked "wake" and only take part in "wakeup".
+ *
+ * usage: msp430_latency_bench [-d seconds per scenario]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+
+#include "nusensors.h"
+#include "msp430_hal.h"
+#include "HubEmulator.h"
+#include "BenchUtil.h"
+
+extern "C" struct sensors_module_t HAL_MODULE_INFO_SYM;
+
+/*****************************************************************************/
+
+#define DEFAULT_SECONDS     5
+#define POLL_EVENTS         64
+// SENSOR_DELAY_GAME, the light load
+#define LIGHT_DELAY_NS      20000000LL
+// Spacing of on-change sensors under the "max" load.
+#define ON_CHANGE_NS        100000000LL
+// Rate wake-up sensors are configured to, and their random gaps.
+#define WAKE_DELAY_NS       200000000LL
+#define WAKE_MIN_MS         20
+#define WAKE_MAX_MS         100
+// Time given to the HAL to hand over the last records before the end.
+#define DRAIN_NS            50000000LL
+
+struct lat_sensor {
+    int handle;
+    const char* name;
+    bool wake;
+    int64_t delay;              // configured rate
+    int64_t period;             // injection spacing, 0 for random wake gaps
+
+    // written by the injector
+    BenchStamps* stamps;
+    uint32_t capacity;
+    int64_t next;
+    uint32_t n;
+
+    // owned by the poll loop
+    int64_t* latency;
+    uint32_t delivered;
+    uint32_t unmatched;
+};
+
+struct scenario {
+    const char* name;
+    struct lat_sensor sensors[SENSORS_NUM_HANDLES];
+    int count;
+    int index[SENSORS_NUM_HANDLES];
+
+    sensors_poll_device_1_t* dev;
+    sensors_poll_device_t* v0;  // the same device, as activate() and poll() take it
+    PipeBackend* backend;
+    int64_t end;
+    volatile int32_t done;
+    unsigned int seed;
+};
+
+static int64_t wake_gap(struct scenario* sc)
+{
+    return (WAKE_MIN_MS + rand_r(&sc->seed) % (WAKE_MAX_MS - WAKE_MIN_MS + 1)) *
+            1000000LL;
+}
+
+/*
+ * Writes each sensor's records at its own period until the end of the
+ * scenario, then flushes the accelerometer so the poll loop, once it has
+ * seen everything through, gets the META_DATA_FLUSH_COMPLETE it stops on.
+ */
+static void* inject(void* arg)
+{
+    struct scenario* sc = static_cast<struct scenario*>(arg);
+    struct msp430_android_sensor_data rec;
+
+    for (;;) {
+        struct lat_sensor* s = NULL;
+
+        for (int i = 0; i < sc->count; i++) {
+            struct lat_sensor* c = &sc->sensors[i];
+            if (c->n < c->capacity && (!s || c->next < s->next))
+                s = c;
+        }
+        if (!s || s->next >= sc->end)
+            break;
+
+        bench_sleep_until(s->next);
+        int64_t ts = bench_now_ns();
+        HubEmulator::fillRecord(&rec, hub_sensors[s->handle].dt, s->n, ts);
+        // published first, the event may be out before write() returns
+        s->stamps->add(ts);
+        s->n++;
+        if (write(sc->backend->writeFd(), &rec, sizeof(rec)) != sizeof(rec)) {
+            fprintf(stderr, "injector write() failed (%s)\n", strerror(errno));
+            break;
+        }
+        s->next += s->period ? s->period : wake_gap(sc);
+    }
+
+    bench_sleep_until(bench_now_ns() + DRAIN_NS);
+    android_atomic_release_store(1, &sc->done);
+    sc->dev->flush(sc->dev, ID_A);
+    return NULL;
+}
+
+/*
+ * The injection an event came from, as long as it is nearer than half the
+ * spacing of the sensor's records.
+ */
+static int64_t match(struct lat_sensor const* s, int64_t timestamp)
+{
+    return s->stamps->find(timestamp,
+            (s->period ? s->period : WAKE_MIN_MS * 1000000LL) / 2);
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// nearest rank, in microseconds
+static double percentile(int64_t const* sorted, uint32_t n, double p)
+{
+    uint32_t rank;
+
+    if (!n)
+        return 0.0;
+    rank = (uint32_t)(p * n + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > n)
+        rank = n;
+    return sorted[rank - 1] / 1000.0;
+}
+
+static void add_sensor(struct scenario* sc, struct sensor_t const* info,
+        int64_t period, uint32_t seconds)
+{
+    int handle = info->handle - SENSORS_HANDLE_BASE;
+    struct lat_sensor* s = &sc->sensors[sc->count];
+    bool wake = hub_sensors[handle].bank == HUB_BANK_WAKE;
+
+    memset(s, 0, sizeof(*s));
+    s->handle = handle;
+    s->name = info->name;
+    s->wake = wake;
+    s->period = period;
+    s->delay = wake ? WAKE_DELAY_NS : period;
+    s->capacity = seconds * 1000000000LL /
+            (period ? period : WAKE_MIN_MS * 1000000LL) + 2;
+    s->stamps = new BenchStamps();
+    s->latency = new int64_t[s->capacity];
+    sc->index[handle] = sc->count++;
+}
+
+/*
+ * Hub sensors a record can be injected for: a record type of their own
+ * and a decoder for it.
+ */
+static bool injectable(int handle)
+{
+    if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+        return false;
+    struct hub_sensor const& desc = hub_sensors[handle];
+    return desc.dt != HUB_DT_NONE && desc.bank != HUB_BANK_NONE &&
+            desc.decoder != HUB_DECODE_NONE && hub_handle_of(desc.dt) == handle;
+}
+
+static int run(struct scenario* sc, uint32_t seconds, bool first)
+{
+    sensors_event_t events[POLL_EVENTS];
+    hw_device_t* device;
+    pthread_t thread;
+    int64_t start;
+    int err = 0;
+    int i;
+
+    sc->backend = new PipeBackend(NULL);
+    if (init_nusensors_backend(&HAL_MODULE_INFO_SYM.common, sc->backend, &device)) {
+        delete sc->backend;
+        return -1;
+    }
+    sc->dev = (sensors_poll_device_1_t*)device;
+    sc->v0 = (sensors_poll_device_t*)device;
+
+    for (i = 0; i < sc->count; i++) {
+        struct lat_sensor* s = &sc->sensors[i];
+        sc->dev->batch(sc->dev, s->handle, 0, s->delay, 0);
+        sc->dev->activate(sc->v0, s->handle, 1);
+    }
+
+    start = bench_now_ns() + 100000000LL;
+    sc->end = start + seconds * 1000000000LL;
+    sc->done = 0;
+    for (i = 0; i < sc->count; i++) {
+        struct lat_sensor* s = &sc->sensors[i];
+        // spread the first records so the streams do not beat together
+        s->next = start + (s->period ? s->period * i / sc->count : wake_gap(sc));
+    }
+    if (pthread_create(&thread, NULL, inject, sc)) {
+        device->close(device);
+        return -1;
+    }
+
+    for (;;) {
+        int n = sc->dev->poll(sc->v0, events, POLL_EVENTS);
+        int64_t now = bench_now_ns();
+        bool finished = false;
+
+        if (n < 0) {
+            fprintf(stderr, "%s: poll() failed (%s)\n", sc->name, strerror(-n));
+            err = -1;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            sensors_event_t const& ev = events[i];
+            if (ev.type == SENSOR_TYPE_META_DATA) {
+                if (ev.meta_data.what == META_DATA_FLUSH_COMPLETE &&
+                        android_atomic_acquire_load(&sc->done))
+                    finished = true;
+                continue;
+            }
+            if (ev.sensor < 0 || ev.sensor >= SENSORS_NUM_HANDLES ||
+                    sc->index[ev.sensor] < 0)
+                continue;
+            struct lat_sensor* s = &sc->sensors[sc->index[ev.sensor]];
+            int64_t k = match(s, ev.timestamp);
+            if (k < 0 || s->delivered == s->capacity) {
+                s->unmatched++;
+            } else {
+                s->latency[s->delivered++] = now - s->stamps->at(k);
+            }
+            // the framework re-arms significant motion after each trigger
+            if (hub_sensors[s->handle].flags & HUB_F_ONE_SHOT)
+                sc->dev->activate(sc->v0, s->handle, 1);
+        }
+        if (finished)
+            break;
+    }
+    pthread_join(thread, NULL);
+
+    for (i = 0; i < sc->count; i++)
+        sc->dev->activate(sc->v0, sc->sensors[i].handle, 0);
+    device->close(device);
+
+    printf("%s    {\n", first ? "" : ",\n");
+    printf("      \"scenario\": \"%s\",\n", sc->name);
+    printf("      \"sensors\": [\n");
+    for (i = 0; i < sc->count; i++) {
+        struct lat_sensor* s = &sc->sensors[i];
+        qsort(s->latency, s->delivered, sizeof(s->latency[0]), compare_ns);
+        printf("        { \"handle\": %d, \"name\": \"%s\", \"wake\": %s, "
+                "\"injected\": %u, \"delivered\": %u, \"unmatched\": %u, ",
+                s->handle, s->name, s->wake ? "true" : "false",
+                s->n, s->delivered, s->unmatched);
+        printf("\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, "
+                "\"max_us\": %.1f }%s\n",
+                percentile(s->latency, s->delivered, 0.50),
+                percentile(s->latency, s->delivered, 0.99),
+                percentile(s->latency, s->delivered, 0.999),
+                percentile(s->latency, s->delivered, 1.0),
+                i == sc->count - 1 ? "" : ",");
+        delete s->stamps;
+        delete[] s->latency;
+    }
+    printf("      ]\n");
+    printf("    }");
+    return err;
+}
+
+static void init_scenario(struct scenario* sc, const char* name)
+{
+    memset(sc, 0, sizeof(*sc));
+    sc->name = name;
+    sc->seed = 1;
+    for (int i = 0; i < SENSORS_NUM_HANDLES; i++)
+        sc->index[i] = -1;
+}
+
+int main(int argc, char** argv)
+{
+    static struct scenario sc;
+    struct sensor_t const* list;
+    struct sensor_t const* accel = NULL;
+    uint32_t seconds = DEFAULT_SECONDS;
+    int count, err = 0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!seconds)
+        return 2;
+
+    count = HAL_MODULE_INFO_SYM.get_sensors_list(&HAL_MODULE_INFO_SYM, &list);
+    for (i = 0; i < count; i++) {
+        if (list[i].handle - SENSORS_HANDLE_BASE == ID_A)
+            accel = &list[i];
+    }
+    if (!accel) {
+        fprintf(stderr, "no accelerometer in the sensor list\n");
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"bench\": \"latency\",\n");
+    printf("  \"seconds\": %u,\n", seconds);
+    printf("  \"results\": [\n");
+
+    init_scenario(&sc, "light");
+    add_sensor(&sc, accel, LIGHT_DELAY_NS, seconds);
+    err |= run(&sc, seconds, true);
+
+    init_scenario(&sc, "max");
+    for (i = 0; i < count; i++) {
+        int handle = list[i].handle - SENSORS_HANDLE_BASE;
+        if (!injectable(handle) || list[i].minDelay < 0 ||
+                hub_sensors[handle].bank == HUB_BANK_WAKE)
+            continue;
+        add_sensor(&sc, &list[i],
+                list[i].minDelay ? list[i].minDelay * 1000LL : ON_CHANGE_NS, seconds);
+    }
+    err |= run(&sc, seconds, false);
+
+    init_scenario(&sc, "wakeup");
+    add_sensor(&sc, accel, accel->minDelay * 1000LL, seconds);
+    for (i = 0; i < count; i++) {
+        int handle = list[i].handle - SENSORS_HANDLE_BASE;
+        if (injectable(handle) && hub_sensors[handle].bank == HUB_BANK_WAKE)
+            add_sensor(&sc, &list[i], 0, seconds);
+    }
+    err |= run(&sc, seconds, false);
+
+    printf("\n  ]\n}\n");
+    return err ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a capture of the data node through HubSensor on the host, every
+ * sensor enabled at its fastest rate, and counts what comes out. The
+ * capture is a raw dump of /dev/msp430_as or a HubRecorder capture pulled
+ * from HUB_CAPTURE_DIR. Prints one JSON object:
+ *
+ *   { "bench": "replay", "speed": S, "records": N, "reads": R,
+ *     "loops": L, "max_late_us": U, "events": E, "seconds": T,
+ *     "handles": [ { "handle", "type", "events" }, ... ] }
+ *
+ * The replay ends with the capture, or after -d seconds when looping.
+ *
+ * usage: msp430_replay [-s speed, 0 for as fast as possible] [-l] [-d seconds] capture
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ReplaySensor.h"
+#include "BenchUtil.h"
+
+/*****************************************************************************/
+
+#define POLL_EVENTS     64
+// How often a looping replay looks at its deadline.
+#define POLL_MS         100
+// Rate every sensor is set to, fast enough that nothing is decimated.
+#define REPLAY_DELAY_NS 1000000LL
+
+int main(int argc, char** argv)
+{
+    static uint32_t counts[SENSORS_NUM_HANDLES];
+    sensors_event_t events[POLL_EVENTS];
+    struct hub_replay_stats stats;
+    int speed = 1;
+    bool loop = false;
+    uint32_t seconds = 0;
+    uint32_t total = 0;
+    int64_t start, last, deadline;
+    int opt, handle;
+
+    while ((opt = getopt(argc, argv, "s:ld:")) != -1) {
+        switch (opt) {
+        case 's':
+            speed = atoi(optarg);
+            break;
+        case 'l':
+            loop = true;
+            break;
+        case 'd':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1 || (loop && !seconds)) {
+        fprintf(stderr, "usage: %s [-s speed] [-l -d seconds] capture\n", argv[0]);
+        return 2;
+    }
+
+    ReplaySensor* hub = new ReplaySensor(argv[optind], speed, loop);
+    for (handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        hub->setDelay(handle, REPLAY_DELAY_NS);
+        hub->enable(handle, 1);
+    }
+
+    start = last = bench_now_ns();
+    deadline = seconds ? start + seconds * 1000000000LL : 0;
+    for (;;) {
+        struct pollfd pfd = { hub->getFd(), POLLIN, 0 };
+        int64_t now;
+        int n;
+
+        if (!hub->hasPendingEvents() && poll(&pfd, 1, POLL_MS) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll() failed (%s)\n", strerror(errno));
+            break;
+        }
+        n = hub->readEvents(events, POLL_EVENTS);
+        now = bench_now_ns();
+        for (int i = 0; i < n; i++) {
+            if (events[i].sensor >= 0 && events[i].sensor < SENSORS_NUM_HANDLES)
+                counts[events[i].sensor]++;
+        }
+        if (n > 0) {
+            total += n;
+            last = now;
+        }
+        if (deadline ? now >= deadline : hub->finished() && !hub->hasPendingEvents())
+            break;
+    }
+    // readEvents() ran on this thread, the stats are current
+    hub->getReplayStats(&stats);
+
+    printf("{\n");
+    printf("  \"bench\": \"replay\",\n");
+    printf("  \"speed\": %d,\n", speed);
+    printf("  \"records\": %u,\n", stats.records);
+    printf("  \"reads\": %u,\n", stats.reads);
+    printf("  \"loops\": %u,\n", stats.loops);
+    printf("  \"max_late_us\": %u,\n", stats.max_late_us);
+    printf("  \"events\": %u,\n", total);
+    printf("  \"seconds\": %.3f,\n", (last - start) / 1e9);
+    printf("  \"handles\": [");
+    const char* sep = "\n";
+    for (handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if (!counts[handle])
+            continue;
+        printf("%s    { \"handle\": %d, \"type\": %d, \"events\": %u }",
+                sep, handle, hub_sensors[handle].type, counts[handle]);
+        sep = ",\n";
+    }
+    printf("\n  ]\n}\n");
+
+    for (handle = 0; handle < SENSORS_NUM_HANDLES; handle++)
+        hub->enable(handle, 0);
+    delete hub;
+    return total ? 0 : 1;
+}
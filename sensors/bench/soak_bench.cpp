@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Soak of the HAL under the heaviest load the sensor list allows: every
+ * sensor of sSensorList enabled at its minDelay, listeners coming and going
+ * at random and hub resets (DT_RESET) thrown in, while the poll thread goes
+ * through a range of event buffer sizes, one phase each. The device is
+ * opened through the module over a PipeBackend; an injector thread writes
+ * the records of the enabled sensors, and each event coming out of poll()
+ * is traced back to its record (see BenchStamps). A record that has not
+ * come out by the time its sensor is SEEN_WINDOW records further counts as
+ * dropped, one that comes out later than a newer one as reordered. Prints
+ * one JSON object:
+ *
+ *   { "bench": "soak", "seconds": S, "sensors": N,
+ *     "phases": [ { "count", "injected", "delivered", "dropped",
+ *                   "unmatched", "reordered", "resets", "toggles",
+ *                   "events_per_s", "cpu_ns_per_event", "peak_rss_kb" },
+ *                 ... ],
+ *     "total": { "injected", "delivered", "dropped", "drop_rate",
+ *                "cpu_ns_per_event", "peak_rss_kb" } }
+ *
+ * "cpu_ns_per_event" is the CPU time of the process less that of the
+ * injector and of the thread driving the listeners, per event delivered.
+ * Exits with 1 if any record was dropped.
+ *
+ * usage: msp430_soak_bench [-d seconds per phase] [-t toggle ms]
+ *                          [-r reset ms, 0 for none]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <cutils/atomic.h>
+
+#include "nusensors.h"
+#include "msp430_hal.h"
+#include "HubEmulator.h"
+#include "BenchUtil.h"
+
+extern "C" struct sensors_module_t HAL_MODULE_INFO_SYM;
+
+/*****************************************************************************/
+
+#define DEFAULT_SECONDS     10
+#define DEFAULT_TOGGLE_MS   50
+#define DEFAULT_RESET_MS    2000
+// Spacing of the records of on-change and wake-up sensors.
+#define ON_CHANGE_NS        100000000LL
+// Time given to the HAL to hand over the last records before the end.
+#define DRAIN_NS            100000000LL
+#define MAX_COUNT           256
+// Records a late one may trail the newest of its sensor by.
+#define SEEN_WINDOW         64
+
+// The poll() buffer sizes swept, one phase each.
+static const int counts[] = { 1, 2, 7, 16, 64, MAX_COUNT };
+#define NUM_PHASES (sizeof(counts) / sizeof(counts[0]))
+
+struct soak_sensor {
+    int handle;
+    int64_t delay;              // minDelay, the rate it is enabled at
+    int64_t period;             // spacing of its records, 0 if it has none
+    volatile int32_t on;        // a listener is registered
+
+    // the injector's
+    BenchStamps* stamps;
+    int64_t next;
+
+    // the poll thread's
+    int64_t last;               // newest sequence seen, -1 if none
+    uint64_t seen;              // bit i: last - i was seen
+};
+
+struct phase {
+    // each written by one thread only, read once all are joined
+    uint32_t injected;          // injector
+    uint32_t resets;
+    uint32_t delivered;         // poll thread
+    uint32_t dropped;
+    uint32_t unmatched;
+    uint32_t reordered;
+    uint32_t toggles;           // main thread
+    int64_t wall;
+    int64_t cpu;
+    long peakRss;
+};
+
+struct soak {
+    sensors_poll_device_1_t* dev;
+    sensors_poll_device_t* v0;  // the same device, as activate() and poll() take it
+    PipeBackend* backend;
+
+    struct soak_sensor sensors[SENSORS_NUM_HANDLES];
+    int count;
+    int index[SENSORS_NUM_HANDLES];
+
+    volatile int32_t phase;
+    volatile int32_t resetPending;
+    volatile int32_t stop;      // injector
+    volatile int32_t done;      // poll thread, on the next flush complete
+    struct phase phases[NUM_PHASES];
+};
+
+/*
+ * Writes the records of the sensors with a listener, each at its own
+ * period, and a DT_RESET whenever one is asked for.
+ */
+static void* inject(void* arg)
+{
+    struct soak* sk = static_cast<struct soak*>(arg);
+    struct msp430_android_sensor_data rec;
+    int i;
+
+    for (i = 0; i < sk->count; i++)
+        sk->sensors[i].next = bench_now_ns() + sk->sensors[i].period * i / sk->count;
+
+    while (!android_atomic_acquire_load(&sk->stop)) {
+        struct phase* ph = &sk->phases[android_atomic_acquire_load(&sk->phase)];
+        struct soak_sensor* s = NULL;
+
+        if (android_atomic_release_cas(1, 0, &sk->resetPending) == 0) {
+            memset(&rec, 0, sizeof(rec));
+            rec.type = DT_RESET;
+            rec.timestamp = bench_now_ns();
+            if (write(sk->backend->writeFd(), &rec, sizeof(rec)) == sizeof(rec))
+                ph->resets++;
+        }
+
+        for (i = 0; i < sk->count; i++) {
+            struct soak_sensor* c = &sk->sensors[i];
+            if (c->period && (!s || c->next < s->next))
+                s = c;
+        }
+        if (!s)
+            break;
+        bench_sleep_until(s->next);
+        s->next += s->period;
+        if (!android_atomic_acquire_load(&s->on))
+            continue;
+
+        int64_t ts = bench_now_ns();
+        HubEmulator::fillRecord(&rec, hub_sensors[s->handle].dt, s->stamps->count(), ts);
+        s->stamps->add(ts);
+        if (write(sk->backend->writeFd(), &rec, sizeof(rec)) != sizeof(rec)) {
+            fprintf(stderr, "injector write() failed (%s)\n", strerror(errno));
+            break;
+        }
+        ph->injected++;
+    }
+    return NULL;
+}
+
+/*
+ * Move the window of s up to seq, returning the records that left it
+ * unseen.
+ */
+static uint32_t advance(struct soak_sensor* s, int64_t seq)
+{
+    int64_t shift = seq - s->last;
+    uint32_t lost;
+
+    if (shift >= SEEN_WINDOW) {
+        lost = SEEN_WINDOW - __builtin_popcountll(s->seen) + (shift - SEEN_WINDOW);
+        s->seen = 1;
+    } else {
+        lost = shift - __builtin_popcountll(s->seen >> (SEEN_WINDOW - shift));
+        s->seen = (s->seen << shift) | 1;
+    }
+    s->last = seq;
+    return lost;
+}
+
+/*
+ * The framework's poll thread, with the buffer size of the current phase.
+ */
+static void* drain(void* arg)
+{
+    struct soak* sk = static_cast<struct soak*>(arg);
+    sensors_event_t events[MAX_COUNT];
+
+    for (;;) {
+        int phase = android_atomic_acquire_load(&sk->phase);
+        struct phase* ph = &sk->phases[phase];
+        int n = sk->dev->poll(sk->v0, events, counts[phase]);
+        bool finished = false;
+
+        if (n < 0) {
+            fprintf(stderr, "poll() failed (%s)\n", strerror(-n));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            sensors_event_t const& ev = events[i];
+            if (ev.type == SENSOR_TYPE_META_DATA) {
+                if (ev.meta_data.what == META_DATA_FLUSH_COMPLETE &&
+                        android_atomic_acquire_load(&sk->done))
+                    finished = true;
+                continue;
+            }
+            if (ev.sensor < 0 || ev.sensor >= SENSORS_NUM_HANDLES ||
+                    sk->index[ev.sensor] < 0) {
+                ph->unmatched++;
+                continue;
+            }
+            struct soak_sensor* s = &sk->sensors[sk->index[ev.sensor]];
+            int64_t seq = s->period ? s->stamps->find(ev.timestamp, s->period / 2) : -1;
+            ph->delivered++;
+            if (seq < 0) {
+                ph->unmatched++;
+            } else if (seq > s->last) {
+                ph->dropped += advance(s, seq);
+            } else {
+                ph->reordered++;
+                if (s->last - seq < SEEN_WINDOW)
+                    s->seen |= 1ULL << (s->last - seq);
+            }
+            // the framework re-arms significant motion after each trigger
+            if ((hub_sensors[s->handle].flags & HUB_F_ONE_SHOT) &&
+                    android_atomic_acquire_load(&s->on))
+                sk->dev->activate(sk->v0, s->handle, 1);
+        }
+        if (finished)
+            break;
+    }
+    return NULL;
+}
+
+static void set_listener(struct soak* sk, struct soak_sensor* s, bool on)
+{
+    if (on) {
+        sk->dev->batch(sk->dev, s->handle, 0, s->delay, 0);
+        sk->dev->activate(sk->v0, s->handle, 1);
+        android_atomic_release_store(1, &s->on);
+    } else {
+        // no more records for it before the HAL is told
+        android_atomic_release_store(0, &s->on);
+        sk->dev->activate(sk->v0, s->handle, 0);
+    }
+}
+
+static int64_t thread_cpu_ns(clockid_t clock)
+{
+    struct timespec t;
+
+    if (clock_gettime(clock, &t))
+        return 0;
+    return int64_t(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
+static long peak_rss_kb()
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru))
+        return 0;
+    return ru.ru_maxrss;
+}
+
+int main(int argc, char** argv)
+{
+    static struct soak sk;
+    struct sensor_t const* list;
+    hw_device_t* device;
+    pthread_t injector, poller;
+    clockid_t injectorClock;
+    uint32_t seconds = DEFAULT_SECONDS;
+    int toggle_ms = DEFAULT_TOGGLE_MS;
+    int reset_ms = DEFAULT_RESET_MS;
+    unsigned int seed = 1;
+    int count, opt, i;
+    size_t p;
+
+    while ((opt = getopt(argc, argv, "d:t:r:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            toggle_ms = atoi(optarg);
+            break;
+        case 'r':
+            reset_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds] [-t toggle_ms] [-r reset_ms]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (!seconds || toggle_ms < 1 || reset_ms < 0)
+        return 2;
+
+    sk.backend = new PipeBackend(NULL);
+    if (init_nusensors_backend(&HAL_MODULE_INFO_SYM.common, sk.backend, &device)) {
+        delete sk.backend;
+        return 1;
+    }
+    sk.dev = (sensors_poll_device_1_t*)device;
+    sk.v0 = (sensors_poll_device_t*)device;
+
+    for (i = 0; i < SENSORS_NUM_HANDLES; i++)
+        sk.index[i] = -1;
+    count = HAL_MODULE_INFO_SYM.get_sensors_list(&HAL_MODULE_INFO_SYM, &list);
+    for (i = 0; i < count; i++) {
+        int handle = list[i].handle - SENSORS_HANDLE_BASE;
+        if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+            continue;
+        struct hub_sensor const& desc = hub_sensors[handle];
+        struct soak_sensor* s = &sk.sensors[sk.count];
+
+        s->handle = handle;
+        s->delay = list[i].minDelay > 0 ? list[i].minDelay * 1000LL : 0;
+        // sensors without a record type of their own are enabled all the same
+        if (desc.dt != HUB_DT_NONE && desc.bank != HUB_BANK_NONE &&
+                desc.decoder != HUB_DECODE_NONE && hub_handle_of(desc.dt) == handle)
+            s->period = s->delay ? s->delay : ON_CHANGE_NS;
+        s->stamps = new BenchStamps();
+        s->last = -1;
+        s->seen = ~0ULL;
+        sk.index[handle] = sk.count++;
+        set_listener(&sk, s, true);
+    }
+    if (sk.index[ID_A] < 0) {
+        fprintf(stderr, "no accelerometer in the sensor list\n");
+        device->close(device);
+        return 1;
+    }
+
+    if (pthread_create(&poller, NULL, drain, &sk))
+        return 1;
+    if (pthread_create(&injector, NULL, inject, &sk))
+        return 1;
+    pthread_getcpuclockid(injector, &injectorClock);
+
+    int64_t nextReset = bench_now_ns() + reset_ms * 1000000LL;
+    for (p = 0; p < NUM_PHASES; p++) {
+        struct phase* ph = &sk.phases[p];
+        int64_t start = bench_now_ns();
+        int64_t end = start + seconds * 1000000000LL;
+        int64_t cpu = thread_cpu_ns(CLOCK_PROCESS_CPUTIME_ID) -
+                thread_cpu_ns(injectorClock) - thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+
+        android_atomic_release_store(p, &sk.phase);
+        while (bench_now_ns() < end) {
+            bench_sleep_until(bench_now_ns() + (1 + rand_r(&seed) % (2 * toggle_ms)) *
+                    1000000LL);
+            // the accelerometer stays, it ends the run
+            struct soak_sensor* s = &sk.sensors[rand_r(&seed) % sk.count];
+            if (s->handle != ID_A) {
+                set_listener(&sk, s, !android_atomic_acquire_load(&s->on));
+                ph->toggles++;
+            }
+            if (reset_ms && bench_now_ns() >= nextReset) {
+                android_atomic_release_store(1, &sk.resetPending);
+                nextReset += reset_ms * 1000000LL;
+            }
+        }
+
+        ph->wall = bench_now_ns() - start;
+        ph->cpu = thread_cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - thread_cpu_ns(injectorClock) -
+                thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        ph->peakRss = peak_rss_kb();
+    }
+
+    android_atomic_release_store(1, &sk.stop);
+    pthread_join(injector, NULL);
+    bench_sleep_until(bench_now_ns() + DRAIN_NS);
+
+    android_atomic_release_store(1, &sk.done);
+    sk.dev->flush(sk.dev, ID_A);
+    pthread_join(poller, NULL);
+
+    // what never came out by the end is lost too
+    struct phase* last = &sk.phases[NUM_PHASES - 1];
+    for (i = 0; i < sk.count; i++) {
+        struct soak_sensor* s = &sk.sensors[i];
+        last->dropped += advance(s, int64_t(s->stamps->count()) - 1 + SEEN_WINDOW);
+        set_listener(&sk, s, false);
+        delete s->stamps;
+    }
+    device->close(device);
+
+    struct phase total;
+    memset(&total, 0, sizeof(total));
+    printf("{\n");
+    printf("  \"bench\": \"soak\",\n");
+    printf("  \"seconds\": %u,\n", seconds);
+    printf("  \"sensors\": %d,\n", sk.count);
+    printf("  \"phases\": [\n");
+    for (p = 0; p < NUM_PHASES; p++) {
+        struct phase const& ph = sk.phases[p];
+        printf("    { \"count\": %d, \"injected\": %u, \"delivered\": %u, "
+                "\"dropped\": %u, \"unmatched\": %u, \"reordered\": %u, "
+                "\"resets\": %u, \"toggles\": %u, ",
+                counts[p], ph.injected, ph.delivered, ph.dropped, ph.unmatched,
+                ph.reordered, ph.resets, ph.toggles);
+        printf("\"events_per_s\": %.0f, \"cpu_ns_per_event\": %.0f, "
+                "\"peak_rss_kb\": %ld }%s\n",
+                ph.delivered * 1e9 / ph.wall,
+                ph.delivered ? (double)ph.cpu / ph.delivered : 0.0,
+                ph.peakRss, p == NUM_PHASES - 1 ? "" : ",");
+        total.injected += ph.injected;
+        total.delivered += ph.delivered;
+        total.dropped += ph.dropped;
+        total.cpu += ph.cpu;
+    }
+    printf("  ],\n");
+    printf("  \"total\": { \"injected\": %u, \"delivered\": %u, \"dropped\": %u, "
+            "\"drop_rate\": %.6f, \"cpu_ns_per_event\": %.0f, \"peak_rss_kb\": %ld }\n",
+            total.injected, total.delivered, total.dropped,
+            total.injected ? (double)total.dropped / total.injected : 0.0,
+            total.delivered ? (double)total.cpu / total.delivered : 0.0,
+            peak_rss_kb());
+    printf("}\n");
+    return total.dropped ? 1 : 0;
+}
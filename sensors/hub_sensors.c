@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+
+#include "hub_sensors.h"
+
+/*****************************************************************************/
+
+#define HUB_DESCRIPTOR(handle, _type, _dt, _bank, _mask, _delay, _group, _decoder, \
+        _flags, sx, sy, sz) \
+    [handle] = { \
+        .type = _type, \
+        .dt = _dt, \
+        .bank = _bank, \
+        .decoder = _decoder, \
+        .mask = _mask, \
+        .delay_ioctl = _delay, \
+        .group = _group, \
+        .flags = _flags, \
+        .scale = { sx, sy, sz }, \
+    },
+
+const struct hub_sensor hub_sensors[SENSORS_NUM_HANDLES] = {
+    HUB_SENSOR_TABLE(HUB_DESCRIPTOR)
+};
+
+// Rows without a record type all land in the spare last slot, which is
+// meant to be written several times.
+#define HUB_TYPE_HANDLE(handle, type, dt, ...) \
+    [(dt) < 0 ? HUB_NUM_TYPES : (dt)] = (dt) < 0 ? 0 : (handle) + 1,
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+const uint8_t hub_type_handle[HUB_NUM_TYPES + 1] = {
+    HUB_SENSOR_TABLE(HUB_TYPE_HANDLE)
+};
+#pragma GCC diagnostic pop
+
+#define HUB_IN_ECOMPASS(handle, type, dt, bank, mask, delay, group, ...) \
+    | ((group) == HUB_GROUP_ECOMPASS ? 1u << (handle) : 0)
+#define HUB_IN_GYRO(handle, type, dt, bank, mask, delay, group, ...) \
+    | ((group) == HUB_GROUP_GYRO ? 1u << (handle) : 0)
+
+const uint32_t hub_group_handles[HUB_NUM_GROUPS] = {
+    [HUB_GROUP_ECOMPASS] = 0 HUB_SENSOR_TABLE(HUB_IN_ECOMPASS),
+    [HUB_GROUP_GYRO] = 0 HUB_SENSOR_TABLE(HUB_IN_GYRO),
+};
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HUB_SENSORS_H
+#define ANDROID_HUB_SENSORS_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+#include <hardware/sensors.h>
+#include <hardware/mot_sensorhub_msp430.h>
+
+#include "linux/msp430.h"
+#include "nusensors.h"
+
+__BEGIN_DECLS
+
+/*****************************************************************************/
+
+// Enable register of the hub a sensor is switched on in.
+#define HUB_BANK_NONE           0   // not backed by the hub
+#define HUB_BANK_SENSORS        1   // MSP430_IOCTL_SET_SENSORS
+#define HUB_BANK_WAKE           2   // MSP430_IOCTL_SET_WAKESENSORS
+
+// Physical sensors shared by several handles, see HubSensor::enable().
+#define HUB_GROUP_NONE          (-1)
+#define HUB_GROUP_ECOMPASS      0
+#define HUB_GROUP_GYRO          1
+#define HUB_NUM_GROUPS          2
+
+// How a record's payload becomes a sensors_event_t.
+#define HUB_DECODE_NONE         0   // no event, record is logged and dropped
+#define HUB_DECODE_VEC3         1   // data1..3 * scale[0..2] into a sensors_vec_t
+#define HUB_DECODE_SCALAR       2   // data1 * scale[0] into data[0]
+#define HUB_DECODE_LIGHT        3
+#define HUB_DECODE_PRESSURE     4
+#define HUB_DECODE_DISP_ROTATE  5
+#define HUB_DECODE_PROX         6
+#define HUB_DECODE_FLAT         7
+#define HUB_DECODE_CAMERA       8
+#define HUB_DECODE_STEP_COUNTER 9
+#define HUB_DECODE_QUATERNION   10  // data1..4 * scale[0] into a unit rotation vector
+#define HUB_NUM_DECODERS        11
+
+#define HUB_F_LISTED            0x01    // advertised in sSensorList
+#define HUB_F_STATUS_HIGH       0x02    // vec3 status is SENSOR_STATUS_ACCURACY_HIGH
+#define HUB_F_STATUS_HUB        0x04    // vec3 status is the one reported by the hub
+#define HUB_F_SAVE_MAG_CAL      0x08    // read back the mag cal when disabled
+#define HUB_F_DELAY_SECONDS     0x10    // delay ioctl takes seconds, not ms
+#define HUB_F_ONE_SHOT          0x20    // disabled after its first event
+#define HUB_F_STREAM            0x40    // reports at its programmed rate, watched for stalls
+
+#define HUB_DT_NONE             (-1)
+#define HUB_NUM_TYPES           (DT_STEP_DETECTOR + 1)
+
+/*
+ * The sensors of the hub, one row per handle:
+ *
+ *   X(handle, event type, record type, bank, enable mask, delay ioctl,
+ *     group, decoder, flags, scale x, scale y, scale z)
+ *
+ * Everything that dispatches on a handle or a DT_* record type is generated
+ * from this table, so a sensor is added or changed here only. Orientation
+ * roll comes from the hub with the opposite sign, the negation is folded
+ * into its scale.
+ */
+#define HUB_SENSOR_TABLE(X) \
+    X(ID_A, SENSOR_TYPE_ACCELEROMETER, DT_ACCEL, HUB_BANK_SENSORS, M_ACCEL, \
+      MSP430_IOCTL_SET_ACC_DELAY, HUB_GROUP_NONE, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STREAM | HUB_F_STATUS_HIGH, CONVERT_A_X, CONVERT_A_Y, CONVERT_A_Z) \
+    X(ID_G, SENSOR_TYPE_GYROSCOPE, DT_GYRO, HUB_BANK_SENSORS, M_GYRO, \
+      MSP430_IOCTL_SET_GYRO_DELAY, HUB_GROUP_GYRO, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STREAM, CONVERT_G_P, CONVERT_G_R, CONVERT_G_Y) \
+    X(ID_PR, SENSOR_TYPE_PRESSURE, DT_PRESSURE, HUB_BANK_SENSORS, M_PRESSURE, \
+      MSP430_IOCTL_SET_PRES_DELAY, HUB_GROUP_NONE, HUB_DECODE_PRESSURE, \
+      HUB_F_LISTED, CONVERT_B, 0, 0) \
+    X(ID_M, SENSOR_TYPE_MAGNETIC_FIELD, DT_MAG, HUB_BANK_SENSORS, M_ECOMPASS, \
+      MSP430_IOCTL_SET_MAG_DELAY, HUB_GROUP_ECOMPASS, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STATUS_HUB | HUB_F_SAVE_MAG_CAL | HUB_F_STREAM, \
+      CONVERT_M_X, CONVERT_M_Y, CONVERT_M_Z) \
+    X(ID_O, SENSOR_TYPE_ORIENTATION, DT_ORIENT, HUB_BANK_SENSORS, M_ECOMPASS, \
+      MSP430_IOCTL_SET_MAG_DELAY, HUB_GROUP_ECOMPASS, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STATUS_HUB | HUB_F_SAVE_MAG_CAL | HUB_F_STREAM, \
+      CONVERT_O_Y, CONVERT_O_P, -CONVERT_O_R) \
+    X(ID_T, SENSOR_TYPE_TEMPERATURE, DT_TEMP, HUB_BANK_SENSORS, M_TEMPERATURE, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED, CONVERT_T, 0, 0) \
+    X(ID_L, SENSOR_TYPE_LIGHT, DT_ALS, HUB_BANK_SENSORS, M_ALS, \
+      0, HUB_GROUP_NONE, HUB_DECODE_LIGHT, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_LA, SENSOR_TYPE_LINEAR_ACCELERATION, DT_LIN_ACCEL, HUB_BANK_SENSORS, M_LIN_ACCEL, \
+      0, HUB_GROUP_NONE, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STATUS_HIGH, CONVERT_A_LIN, CONVERT_A_LIN, CONVERT_A_LIN) \
+    X(ID_Q, SENSOR_TYPE_ROTATION_VECTOR, DT_QUATERNION, HUB_BANK_SENSORS, M_QUATERNION, \
+      0, HUB_GROUP_NONE, HUB_DECODE_QUATERNION, \
+      HUB_F_LISTED, CONVERT_QUA, 0, 0) \
+    X(ID_GR, SENSOR_TYPE_GRAVITY, DT_GRAVITY, HUB_BANK_SENSORS, M_GRAVITY, \
+      0, HUB_GROUP_NONE, HUB_DECODE_VEC3, \
+      HUB_F_LISTED | HUB_F_STATUS_HIGH, CONVERT_A_GRAV, CONVERT_A_GRAV, CONVERT_A_GRAV) \
+    X(ID_DR, SENSOR_TYPE_DISPLAY_ROTATE, DT_DISP_ROTATE, HUB_BANK_SENSORS, M_DISP_ROTATE, \
+      0, HUB_GROUP_NONE, HUB_DECODE_DISP_ROTATE, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_DB, SENSOR_TYPE_DISPLAY_BRIGHTNESS, DT_DISP_BRIGHT, HUB_BANK_SENSORS, M_DISP_BRIGHTNESS, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED, 1.0f, 0, 0) \
+    X(ID_D, SENSOR_TYPE_DOCK, DT_DOCK, HUB_BANK_WAKE, M_DOCK, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED, 1.0f, 0, 0) \
+    X(ID_P, SENSOR_TYPE_PROXIMITY, DT_PROX, HUB_BANK_WAKE, M_PROXIMITY, \
+      0, HUB_GROUP_NONE, HUB_DECODE_PROX, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_FU, SENSOR_TYPE_FLAT_UP, DT_FLAT_UP, HUB_BANK_WAKE, M_FLATUP, \
+      0, HUB_GROUP_NONE, HUB_DECODE_FLAT, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_FD, SENSOR_TYPE_FLAT_DOWN, DT_FLAT_DOWN, HUB_BANK_WAKE, M_FLATDOWN, \
+      0, HUB_GROUP_NONE, HUB_DECODE_FLAT, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_S, SENSOR_TYPE_STOWED, DT_STOWED, HUB_BANK_WAKE, M_STOWED, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED, 1.0f, 0, 0) \
+    X(ID_CA, SENSOR_TYPE_CAMERA_ACTIVATE, DT_CAMERA_ACT, HUB_BANK_WAKE, M_CAMERA_ACT, \
+      0, HUB_GROUP_NONE, HUB_DECODE_CAMERA, \
+      HUB_F_LISTED, 0, 0, 0) \
+    X(ID_NFC, SENSOR_TYPE_NFC_DETECT, DT_NFC, HUB_BANK_WAKE, M_NFC, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED | HUB_F_SAVE_MAG_CAL, 1.0f, 0, 0) \
+    X(ID_IR_GESTURE, SENSOR_TYPE_IR_GESTURE, HUB_DT_NONE, HUB_BANK_NONE, 0, \
+      0, HUB_GROUP_NONE, HUB_DECODE_NONE, \
+      0, 0, 0, 0) \
+    X(ID_IR_RAW, SENSOR_TYPE_IR_RAW, HUB_DT_NONE, HUB_BANK_NONE, 0, \
+      0, HUB_GROUP_NONE, HUB_DECODE_NONE, \
+      0, 0, 0, 0) \
+    X(ID_SIM, SENSOR_TYPE_SIGNIFICANT_MOTION, DT_SIM, HUB_BANK_WAKE, M_SIM, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED | HUB_F_ONE_SHOT, 1.0f, 0, 0) \
+    X(ID_STEP_DETECTOR, SENSOR_TYPE_STEP_DETECTOR, DT_STEP_DETECTOR, HUB_BANK_SENSORS, M_STEP_DETECTOR, \
+      0, HUB_GROUP_NONE, HUB_DECODE_SCALAR, \
+      HUB_F_LISTED, 1.0f, 0, 0) \
+    X(ID_STEP_COUNTER, SENSOR_TYPE_STEP_COUNTER, DT_STEP_COUNTER, HUB_BANK_SENSORS, M_STEP_COUNTER, \
+      MSP430_IOCTL_SET_STEP_COUNTER_DELAY, HUB_GROUP_NONE, HUB_DECODE_STEP_COUNTER, \
+      HUB_F_LISTED | HUB_F_DELAY_SECONDS, 0, 0, 0) \
+    X(ID_UNCALIB_GYRO, SENSOR_TYPE_GYROSCOPE_UNCALIBRATED, HUB_DT_NONE, HUB_BANK_SENSORS, M_GYRO, \
+      MSP430_IOCTL_SET_GYRO_DELAY, HUB_GROUP_GYRO, HUB_DECODE_NONE, \
+      0, CONVERT_G_P, CONVERT_G_R, CONVERT_G_Y) \
+    X(ID_UNCALIB_MAG, SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED, HUB_DT_NONE, HUB_BANK_SENSORS, M_ECOMPASS, \
+      MSP430_IOCTL_SET_MAG_DELAY, HUB_GROUP_ECOMPASS, HUB_DECODE_NONE, \
+      HUB_F_SAVE_MAG_CAL, CONVERT_M_X, CONVERT_M_Y, CONVERT_M_Z)
+
+struct hub_sensor {
+    int32_t type;           // SENSOR_TYPE_* of its events
+    int16_t dt;             // DT_* record carrying its events, HUB_DT_NONE if none
+    uint8_t bank;
+    uint8_t decoder;
+    uint32_t mask;          // M_* bit in its bank
+    int delay_ioctl;        // 0 if the rate is not programmable
+    int8_t group;
+    uint8_t flags;
+    float scale[3];
+};
+
+// Indexed by handle.
+extern const struct hub_sensor hub_sensors[SENSORS_NUM_HANDLES];
+
+// Handles of each group, indexed by HUB_GROUP_*.
+extern const uint32_t hub_group_handles[HUB_NUM_GROUPS];
+
+// Handle + 1 of each DT_* record type, 0 for records no sensor is fed by.
+extern const uint8_t hub_type_handle[HUB_NUM_TYPES + 1];
+
+static inline int hub_handle_of(unsigned type)
+{
+    return type < HUB_NUM_TYPES ? hub_type_handle[type] - 1 : -1;
+}
+
+// Number of rows flagged HUB_F_LISTED, checked against sSensorList.
+#define HUB_COUNT_LISTED(handle, type, dt, bank, mask, delay, group, decoder, flags, ...) \
+    + (((flags) & HUB_F_LISTED) ? 1 : 0)
+#define HUB_NUM_LISTED (0 HUB_SENSOR_TABLE(HUB_COUNT_LISTED))
+
+/*****************************************************************************/
+
+__END_DECLS
+
+#endif  // ANDROID_HUB_SENSORS_H
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -12,6 +13,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <cutils/log.h>
 #include "linux/msp430.h"
 
@@ -32,6 +36,8 @@
 #define MSP_MAX_GENERIC_COMMAND_LEN 3
 #define MSP_FORCE_DOWNLOAD_MSG  "Use -f option to ignore version check eg: msp430 boot -f\n"
 #define FLASH_START_ADDRESS 0x08000000
+/* HUB_STATS_SOCKET of the HAL, abstract namespace */
+#define MSP_STATS_SOCKET "msp430_stats"
 
 
 #define CHECK_RETURN_VALUE( ret, msg)  if (ret < 0) {\
@@ -76,6 +82,7 @@ typedef enum tag_mspmode
 	TACTIVE_MODE,
 	TPASSIVE_MODE,
 	READWRITE,
+	STATS,
 	//LOWPOWER_MODE,
 	INVALID
 }eMsp_Mode;
@@ -208,6 +215,38 @@ EXIT:
 	return ret;
 }
 
+/* print the HAL statistics, format is "text" or "json" */
+int msp_dump_stats(const char *format)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	char buf[1024];
+	ssize_t n;
+	int sock;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path + 1, MSP_STATS_SOCKET, sizeof(addr.sun_path) - 2);
+	len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(MSP_STATS_SOCKET);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, len) < 0) {
+		LOGERROR("Unable to reach the sensors HAL: %s\n", strerror(errno))
+		if (sock >= 0)
+			close(sock);
+		return MSP_FAILURE;
+	}
+	if (write(sock, format, strlen(format)) < 0) {
+		LOGERROR("Unable to send stats request: %s\n", strerror(errno))
+		close(sock);
+		return MSP_FAILURE;
+	}
+	while ((n = read(sock, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, n, stdout);
+	close(sock);
+	return n < 0 ? MSP_FAILURE : MSP_SUCCESS;
+}
+
 int  main(int argc, char *argv[])
 {
 
@@ -256,6 +295,8 @@ int  main(int argc, char *argv[])
 		emode = VERSION;
 	else if(!strcmp(argv[1], "readwrite"))
 		emode = READWRITE;
+	else if(!strcmp(argv[1], "stats"))
+		emode = STATS;
 	/*else if(!strcmp(argv[1], "lowpower"))
 		emode = LOWPOWER_MODE;*/
 
@@ -265,6 +306,10 @@ int  main(int argc, char *argv[])
 			versioncheck = false;
 	}
 
+	/* served by the HAL, the driver is not needed */
+	if (emode == STATS)
+		return msp_dump_stats(argc > 2 ? argv[2] : "text");
+
 	/* open the device */
 	fd = open(MSP_DRIVER,O_RDONLY|O_WRONLY);
 	if( fd < 0) {
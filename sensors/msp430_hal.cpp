@@ -17,6 +17,7 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <stdio.h>
 #include <math.h>
 #include <poll.h>
 #include <unistd.h>
@@ -27,695 +28,1523 @@
 #include <linux/akm8975.h>
 #include <linux/msp430.h>
 
+#include <cutils/atomic.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <hardware/mot_sensorhub_msp430.h>
 
 #include "msp430_hal.h"
+#include "HubConvert.h"
+#include "hub_sensors.h"
 
-//stop logging to /data partition
+// no bug reports for record types this hub should never send
 #define DONTBUGME 1
 
 /*****************************************************************************/
 
-HubSensor::HubSensor()
+/*
+ * The txn, reset and watchdog stats are all 32 bit fields, each with one
+ * writer thread, copied out by the stats thread: stored and loaded whole
+ * as atomics, never read-modify-written.
+ */
+static inline void stat_set(uint32_t& field, uint32_t value)
+{
+    android_atomic_release_store(int32_t(value), (volatile int32_t*)&field);
+}
+
+static inline void stat_inc(uint32_t& field)
+{
+    stat_set(field, field + 1);
+}
+
+static void stat_copy(void* to, void const* from, size_t size)
+{
+    const volatile int32_t* src = (const volatile int32_t*)from;
+    int32_t* dst = (int32_t*)to;
+
+    for (size_t i = 0; i < size / sizeof(int32_t); i++)
+        dst[i] = android_atomic_acquire_load(&src[i]);
+}
+
+/*****************************************************************************/
+
+/*
+ * Payload decoders, indexed by HUB_DECODE_*. The event header is filled in
+ * by HubSensor::decodeRecord() from the sensor's hub_sensors.h row; xyz is
+ * only set for HUB_DECODE_VEC3 records. Each returns the number of events
+ * produced.
+ */
+typedef int (*hub_decode_t)(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data);
+
+static int decode_none(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    ALOGE("Default case %x event unhandled", buff.type);
+    return 0;
+}
+
+static int decode_vec3(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    // acceleration, gyro, magnetic and orientation share sensors_vec_t
+    data->acceleration.x = xyz[0];
+    data->acceleration.y = xyz[1];
+    data->acceleration.z = xyz[2];
+    if (desc.flags & HUB_F_STATUS_HIGH)
+        data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    else if (desc.flags & HUB_F_STATUS_HUB)
+        data->acceleration.status = buff.status;
+    return 1;
+}
+
+static int decode_scalar(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    data->data[0] = MSP16TOH(buff.data1) * desc.scale[0];
+    return 1;
+}
+
+static int decode_light(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    data->light = (uint16_t)MSP16TOH(buff.data1);
+    return 1;
+}
+
+static int decode_pressure(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    data->pressure = (uint32_t)(((MSP16TOH(buff.data1)) << 16) |
+            ((MSP16TOH(buff.data2) & 0xFFFF))) * desc.scale[0];
+    return 1;
+}
+
+static int decode_disp_rotate(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    if (buff.data1 == DISP_FLAT)
+        data->data[0] = DISP_UNKNOWN;
+    else
+        data->data[0] = buff.data1;
+    return 1;
+}
+
+static int decode_prox(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    if (buff.data1 == 0) {
+        data->distance = PROX_UNCOVERED;
+        ALOGE("Proximity uncovered");
+    } else if (buff.data1 == 1) {
+        data->distance = PROX_COVERED;
+        ALOGE("Proximity covered 1");
+    } else {
+        data->distance = PROX_SATURATED;
+        ALOGE("Proximity covered 2");
+    }
+    return 1;
+}
+
+static int decode_flat(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    // the hub reports 0x01 when lying face up and 0x02 face down
+    int detected = desc.dt == DT_FLAT_UP ? 0x01 : 0x02;
+
+    if (buff.data1 == detected)
+        data->data[0] = FLAT_DETECTED;
+    else
+        data->data[0] = FLAT_NOTDETECTED;
+    return 1;
+}
+
+static int decode_camera(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    data->data[0] = MSP430_CAMERA_DATA;
+    data->data[1] = MSP16TOH(buff.data1);
+    return 1;
+}
+
+static int decode_step_counter(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    data->u64.step_counter =  (
+            (((uint64_t)MSP16TOH(buff.data4)) << 48) |
+            (((uint64_t)MSP16TOH(buff.data3)) << 32) |
+            (((uint64_t)MSP16TOH(buff.data2)) << 16) |
+            (((uint64_t)MSP16TOH(buff.data1))) );
+    return 1;
+}
+
+/*
+ * The hub's fusion reports its attitude quaternion as (x, y, z, w) in Q14
+ * fixed point. Q14 rounding leaves it slightly off unit length, so it is
+ * renormalized, and it is kept in the w >= 0 hemisphere like the
+ * framework's own fusion does.
+ */
+static int decode_quaternion(struct hub_sensor const& desc,
+        struct msp430_android_sensor_data const& buff, const float* xyz,
+        sensors_event_t* data)
+{
+    float q[4] = {
+        MSP16TOH(buff.data1) * desc.scale[0],
+        MSP16TOH(buff.data2) * desc.scale[0],
+        MSP16TOH(buff.data3) * desc.scale[0],
+        MSP16TOH(buff.data4) * desc.scale[0],
+    };
+    float norm = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+
+    if (norm == 0.0f)
+        return 0;
+    if (q[3] < 0.0f)
+        norm = -norm;
+    for (int i = 0; i < 4; i++)
+        data->data[i] = q[i] / norm;
+    data->data[4] = -1.0f;     // heading accuracy not reported by the hub
+    return 1;
+}
+
+static const hub_decode_t sDecoders[HUB_NUM_DECODERS] = {
+    decode_none,            /* HUB_DECODE_NONE */
+    decode_vec3,            /* HUB_DECODE_VEC3 */
+    decode_scalar,          /* HUB_DECODE_SCALAR */
+    decode_light,           /* HUB_DECODE_LIGHT */
+    decode_pressure,        /* HUB_DECODE_PRESSURE */
+    decode_disp_rotate,     /* HUB_DECODE_DISP_ROTATE */
+    decode_prox,            /* HUB_DECODE_PROX */
+    decode_flat,            /* HUB_DECODE_FLAT */
+    decode_camera,          /* HUB_DECODE_CAMERA */
+    decode_step_counter,    /* HUB_DECODE_STEP_COUNTER */
+    decode_quaternion,      /* HUB_DECODE_QUATERNION */
+};
+
+/*****************************************************************************/
+
+/*
+ * With a backend, it takes the place of the device nodes and is deleted
+ * with the sensor.
+ */
+HubSensor::HubSensor(HubBackend* backend)
 : SensorBase(SENSORHUB_DEVICE_NAME, SENSORHUB_AS_DATA_NAME),
       mEnabled(0),
       mWakeEnabled(0),
-      mPendingMask(0)
+      mPendingMask(0),
+      mBulkRead(true),
+      mBackend(backend),
+      mReader(NULL),
+      mRecorder(NULL),
+      mRecordBytes(0),
+      mRecordHead(0),
+      mPendingHead(0),
+      mPendingCount(0),
+      mClients(0),
+      mClockSync(true),
+      mReadTime(0),
+      mSeenClients(0),
+      mWantEnabled(0),
+      mWantWake(0),
+      mDirtyGroups(0),
+      mDirtyDelays(0),
+      mDelayExtra(0),
+      mHwDelayValid(0),
+      mTxnDepth(0),
+      mTxnWindowMs(0),
+      mFlushAt(0),
+      mHubStale(false),
+      mStaleBanks(0),
+      mRetryAt(0),
+      mRetryMs(0),
+      mResetTime(0),
+      mWatchdog(true),
+      mWatchAt(0),
+      mStallStep(0),
+      mStallTime(0),
+      mCalStore(HUB_CAL_FILE),
+      mControl(controlHandler, this),
+      mDeferRestore(0),
+      mDeferDisable(0)
 {
     // read the actual value of all sensors if they're enabled already
     struct input_absinfo absinfo;
     short flags = 0;
-    FILE *fp;
-    int i;
-    int err = 0;
+    char value[PROPERTY_VALUE_MAX];
 
     memset(mMagCal, 0, sizeof(mMagCal));
+    memset(&mReadStats, 0, sizeof(mReadStats));
+    memset(mLastDelivered, 0, sizeof(mLastDelivered));
+    memset(mSharedDelay, 0xff, sizeof(mSharedDelay));
+    memset((void*)mDecimateUs, 0, sizeof(mDecimateUs));
+    memset(mWantShared, 0xff, sizeof(mWantShared));
+    memset(mHwDelay, 0, sizeof(mHwDelay));
+    memset(&mTxnStats, 0, sizeof(mTxnStats));
+    memset(&mResetStats, 0, sizeof(mResetStats));
+    memset(mWatchSince, 0, sizeof(mWatchSince));
+    memset((void*)mSeenMs, 0, sizeof(mSeenMs));
+    memset(&mWatchdogStats, 0, sizeof(mWatchdogStats));
+    for (int i = 0; i < SENSORS_NUM_HANDLES; i++)
+        mDelayNs[i] = HUB_DEFAULT_DELAY_NS;
 
-    open_device();
+    // before the first ioctl, which is timed
+    property_get(MSP430_PROFILE_PROPERTY, value, "0");
+    if (!strcmp(value, "cycles"))
+        mProfiler.enable(true);
+    else if (atoi(value))
+        mProfiler.enable(false);
 
-    if (!ioctl(dev_fd, MSP430_IOCTL_GET_SENSORS, &flags))  {
+    property_get(MSP430_BULK_READ_PROPERTY, value, "1");
+    mBulkRead = atoi(value) != 0;
+
+    if (!mBackend)
+        open_device();
+
+    if (!hubIoctl(MSP430_IOCTL_GET_SENSORS, &flags))  {
         mEnabled = flags;
+        mWantEnabled = flags;
     }
 
-    if (!ioctl(dev_fd, MSP430_IOCTL_GET_WAKESENSORS, &flags))  {
+    if (!hubIoctl(MSP430_IOCTL_GET_WAKESENSORS, &flags))  {
         mWakeEnabled = flags;
+        mWantWake = flags;
     }
 
-    if ((fp = fopen(MAG_CAL_FILE, "r")) != NULL) {
-        for (i=0; i<MSP_MAG_CAL_SIZE; i++) {
-            mMagCal[i] = fgetc(fp);
-        }
-        fclose(fp);
-        err = ioctl(dev_fd, MSP430_IOCTL_SET_MAG_CAL, &mMagCal);
-        if (err < 0) {
-           ALOGE("Can't send Mag Cal data");
+    property_get(MSP430_TXN_WINDOW_PROPERTY, value, "5");
+    mTxnWindowMs = atoi(value);
+    property_get(MSP430_WATCHDOG_PROPERTY, value, "1");
+    mWatchdog = atoi(value) != 0;
+
+    mCalStore.start();
+    property_get(HUB_DIAG_PROPERTY, value, "1");
+    if (atoi(value))
+        mDiag.start();
+    // from here on the hub is only touched from the control thread
+    mControl.start();
+    mControl.post(HUB_CMD_LOAD_MAG_CAL, 0, 0);
+
+    property_get(MSP430_CLOCK_SYNC_PROPERTY, value, "1");
+    mClockSync = atoi(value) != 0;
+    if (mClockSync)
+        mControl.post(HUB_CMD_SET_TIME, 0, 0);
+
+    if (property_get(MSP430_CAPTURE_PROPERTY, value, NULL) > 0)
+        startCapture(value);
+
+    property_get(MSP430_READER_THREAD_PROPERTY, value, "0");
+    if (atoi(value) && !mBackend) {
+        mReader = new HubReader(data_fd);
+        if (mReader->start()) {
+            delete mReader;
+            mReader = NULL;
         }
     }
+
+    property_get(MSP430_STATS_PROPERTY, value, "1");
+    if (atoi(value))
+        mStats.start(dumpStats, this);
 }
 
 HubSensor::~HubSensor()
 {
+    // the dump reads all of the below
+    mStats.stop();
+    // both threads must be gone before SensorBase closes the fds
+    delete mReader;
+    mControl.stop();
+    // after the control thread, so a save from a last disable is written
+    mCalStore.stop();
+    mDiag.stop();
+    delete mRecorder;
+    delete mBackend;
+}
+
+int HubSensor::getFd() const
+{
+    if (mReader)
+        return mReader->getFd();
+    return mBackend ? mBackend->getFd() : data_fd;
+}
+
+int HubSensor::hubIoctl(unsigned int cmd, void* arg)
+{
+    uint64_t t0 = mProfiler.start();
+    int ret = mBackend ? mBackend->ioctl(cmd, arg) : ioctl(dev_fd, cmd, arg);
+    int err = errno;
+
+    mProfiler.stop(HUB_PROF_IOCTL, t0);
+    mStats.ioctl(cmd, ret, err);
+    errno = err;
+    return ret;
+}
+
+ssize_t HubSensor::readData(void* buf, size_t len)
+{
+    return mBackend ? mBackend->read(buf, len) : read(data_fd, buf, len);
+}
+
+/*
+ * Physical rate of a shared sensor for the given clients: the fastest delay
+ * any of them asked for, 0xffff if none is enabled.
+ */
+unsigned short HubSensor::sharedDelay(int group, uint32_t clients, int* delay_ioctl) const
+{
+    unsigned short delay = 0xffff;
+
+    clients &= hub_group_handles[group];
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if (!(clients & (1 << handle)))
+            continue;
+        // all clients of a group program the same rate
+        *delay_ioctl = hub_sensors[handle].delay_ioctl;
+        if (mDelayNs[handle] / 1000000 < delay)
+            delay = mDelayNs[handle] / 1000000;
+    }
+    return delay;
+}
+
+/*
+ * Program the physical rate of a shared sensor for its enabled clients plus
+ * those in extra (clients about to be enabled). The ioctl is skipped when
+ * the rate does not change.
+ */
+int HubSensor::updateSharedDelay(int group, uint32_t extra)
+{
+    int delay_ioctl = 0;
+    unsigned short delay;
+    int status = 0;
+
+    delay = sharedDelay(group, mClients | extra, &delay_ioctl);
+    if (!delay_ioctl)
+        return 0;
+    if (delay != mSharedDelay[group]) {
+        status = hubIoctl(delay_ioctl, &delay);
+        stat_inc(mTxnStats.issued);
+        if (!status)
+            mSharedDelay[group] = delay;
+    }
+    publishDecimation(group);
+    return status;
+}
+
+/*
+ * Tell the data path how far apart events of each client of a shared sensor
+ * must be: at least the client's period, less half a hub period to absorb
+ * jitter, or 0 to keep them all.
+ */
+void HubSensor::publishDecimation(int group)
+{
+    int64_t hubPeriod = mSharedDelay[group] * 1000000LL;
+
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        int32_t interval = 0;
+
+        if (!(hub_group_handles[group] & (1 << handle)))
+            continue;
+        if (mSharedDelay[group] != 0xffff && mDelayNs[handle] > hubPeriod)
+            interval = (mDelayNs[handle] - hubPeriod / 2) / 1000;
+        android_atomic_release_store(interval, &mDecimateUs[handle]);
+    }
+}
+
+/*
+ * Restore the mag calibration from the store, importing the legacy file
+ * the first time. Runs on the control thread.
+ */
+void HubSensor::loadMagCal()
+{
+    int fd;
+
+    mCalStore.load();
+    if (mCalStore.get(HUB_CAL_MAG, mMagCal, sizeof(mMagCal))) {
+        fd = open(MAG_CAL_FILE, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (read(fd, mMagCal, sizeof(mMagCal)) != sizeof(mMagCal)) {
+            close(fd);
+            return;
+        }
+        close(fd);
+        mCalStore.put(HUB_CAL_MAG, mMagCal, sizeof(mMagCal));
+    }
+    if (hubIoctl(MSP430_IOCTL_SET_MAG_CAL, &mMagCal) < 0) {
+       ALOGE("Can't send Mag Cal data");
+    }
+}
+
+/*
+ * Fetch the mag calibration from the hub and hand it to the store, which
+ * writes it later and only if it changed.
+ */
+void HubSensor::saveMagCal()
+{
+    int err;
+
+    err = hubIoctl(MSP430_IOCTL_GET_MAG_CAL, &mMagCal);
+    if (err < 0) {
+        ALOGE("Can't read Mag Cal data");
+    } else {
+        mCalStore.put(HUB_CAL_MAG, mMagCal, sizeof(mMagCal));
+    }
 }
 
 int HubSensor::enable(int32_t handle, int en)
+{
+    if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+        return -EINVAL;
+    return mControl.call(HUB_CMD_ENABLE, handle, en ? 1 : 0);
+}
+
+/*
+ * Hold back enable and rate changes until the matching commitUpdate(), to
+ * apply a whole re-configuration with one write per hub register.
+ * Transactions nest.
+ */
+int HubSensor::beginUpdate()
+{
+    return mControl.call(HUB_CMD_BEGIN, 0, 0);
+}
+
+int HubSensor::commitUpdate()
+{
+    return mControl.call(HUB_CMD_COMMIT, 0, 0);
+}
+
+int HubSensor::setDelay(int32_t handle, int64_t ns)
+{
+    if (ns < 0)
+        return -EINVAL;
+    if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+        return -EINVAL;
+    if (hub_sensors[handle].bank == HUB_BANK_NONE)
+        return -EINVAL;
+    return mControl.call(HUB_CMD_SET_DELAY, handle, ns);
+}
+
+int HubSensor::controlHandler(void* cookie, struct hub_command const& cmd)
+{
+    HubSensor* const self = static_cast<HubSensor*>(cookie);
+
+    switch (cmd.op) {
+        case HUB_CMD_ENABLE:
+            return self->doEnable(cmd.handle, cmd.arg);
+        case HUB_CMD_SET_DELAY:
+            return self->doSetDelay(cmd.handle, cmd.arg);
+        case HUB_CMD_LOAD_MAG_CAL:
+            self->loadMagCal();
+            return 0;
+        case HUB_CMD_SET_TIME:
+            return self->setHubTime();
+        case HUB_CMD_BEGIN:
+            self->mTxnDepth++;
+            return 0;
+        case HUB_CMD_COMMIT:
+            if (!self->mTxnDepth)
+                return -EINVAL;
+            return --self->mTxnDepth ? 0 : self->flushConfig();
+        case HUB_CMD_RESTORE:
+            return self->restoreState();
+        case HUB_CONTROL_TIMER:
+            return self->onTimer();
+        case HUB_CONTROL_WAKEUP:
+            return self->runDeferred();
+    }
+    return -EINVAL;
+}
+
+/*
+ * What decodeRecord() had to leave behind when the control queue was full:
+ * the restore after a hub reset, one-shot sensors that fired.
+ */
+int HubSensor::runDeferred()
+{
+    uint32_t off = android_atomic_and(0, &mDeferDisable);
+    int err = 0, ret;
+
+    if (android_atomic_and(0, &mDeferRestore))
+        err = restoreState();
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if ((off & (1 << handle)) && (ret = doEnable(handle, 0)) < 0)
+            err = ret;
+    }
+    return err;
+}
+
+/*
+ * The control thread is the only writer of the enable masks; the data path
+ * reads mClients without locking. The hub itself is only written by
+ * flushConfig().
+ */
+int HubSensor::doEnable(int32_t handle, int en)
 {
     int newState  = en ? 1 : 0;
-    uint32_t new_enabled;
-    int found = 0;
+    uint32_t* want = NULL;
+    uint32_t clients;
+    int delay_ioctl = 0;
+
+    struct hub_sensor const& desc = hub_sensors[handle];
+    clients = newState ? (mClients | (1 << handle)) : (mClients & ~(1 << handle));
+    if (desc.group != HUB_GROUP_NONE) {
+        // the hardware stays on while any of its logical clients is enabled
+        newState = (clients & hub_group_handles[desc.group]) != 0;
+    }
+
+    ALOGE_IF(desc.flags & HUB_F_ONE_SHOT, "Signifigant Motion enabled? %d", newState);
+    if (!newState && (desc.flags & HUB_F_SAVE_MAG_CAL))
+        saveMagCal();
+
+    if (desc.bank == HUB_BANK_SENSORS)
+        want = &mWantEnabled;
+    else if (desc.bank == HUB_BANK_WAKE)
+        want = &mWantWake;
+    if (want) {
+        uint32_t mask = newState ? (*want | desc.mask) : (*want & ~desc.mask);
+        if (mask != *want) {
+            *want = mask;
+            stat_inc(mTxnStats.requested);
+        }
+    }
+
+    android_atomic_release_store(clients, &mClients);
+    mDelayExtra &= ~(1 << handle);
+    if (desc.group != HUB_GROUP_NONE) {
+        unsigned short delay = sharedDelay(desc.group, clients, &delay_ioctl);
+        if (delay_ioctl && delay != mWantShared[desc.group]) {
+            mWantShared[desc.group] = delay;
+            stat_inc(mTxnStats.requested);
+        }
+        mDirtyGroups |= 1 << desc.group;
+    }
+    if (en)
+        watchHandle(handle);
+
+    return scheduleFlush();
+}
+
+int HubSensor::doSetDelay(int32_t handle, int64_t ns)
+{
+    struct hub_sensor const& desc = hub_sensors[handle];
+    int delay_ioctl = 0;
+
+    mDelayNs[handle] = ns;
+    mStats.setDelay(handle, ns);
+    watchHandle(handle);
+    if (desc.group != HUB_GROUP_NONE) {
+        if (!(mClients & (1 << handle)))
+            mDelayExtra |= 1 << handle;
+        unsigned short delay = sharedDelay(desc.group, mClients | mDelayExtra, &delay_ioctl);
+        if (delay_ioctl && delay != mWantShared[desc.group]) {
+            mWantShared[desc.group] = delay;
+            stat_inc(mTxnStats.requested);
+        }
+        mDirtyGroups |= 1 << desc.group;
+    } else if (desc.delay_ioctl) {
+        stat_inc(mTxnStats.requested);
+        mDirtyDelays |= 1 << handle;
+    } else {
+        return 0;
+    }
+    return scheduleFlush();
+}
+
+/*
+ * Apply the gathered changes now, or at the end of the transaction window
+ * or of the open transaction. Changes that arrive meanwhile join the same
+ * flush.
+ */
+int HubSensor::scheduleFlush()
+{
+    if (mTxnDepth || mFlushAt)
+        return 0;
+    if (mTxnWindowMs > 0) {
+        mFlushAt = getTimestamp() + mTxnWindowMs * 1000000LL;
+        if (armTimer() == 0)
+            return 0;
+        mFlushAt = 0;
+    }
+    return flushConfig();
+}
+
+/*
+ * A flush failed to write the hub: run it again after a backoff rather
+ * than leave it to the next enable() or setDelay().
+ */
+void HubSensor::scheduleRetry()
+{
+    mRetryMs = mRetryMs ? mRetryMs * 2 : HUB_RETRY_MIN_MS;
+    if (mRetryMs > HUB_RETRY_MAX_MS)
+        mRetryMs = HUB_RETRY_MAX_MS;
+    mRetryAt = getTimestamp() + mRetryMs * 1000000LL;
+    if (armTimer())
+        mRetryAt = 0;
+}
+
+/*
+ * Point the control thread's timer at the earliest of the flush, retry and
+ * watchdog deadlines.
+ */
+int HubSensor::armTimer()
+{
+    int64_t next = mFlushAt;
+    int64_t now;
+
+    if (mRetryAt && (!next || mRetryAt < next))
+        next = mRetryAt;
+    if (mWatchAt && (!next || mWatchAt < next))
+        next = mWatchAt;
+    if (!next)
+        return mControl.setTimer(-1);
+    now = getTimestamp();
+    return mControl.setTimer(next > now ? (next - now + 999999) / 1000000 : 0);
+}
+
+int HubSensor::onTimer()
+{
+    int64_t now = getTimestamp();
     int err = 0;
 
-    new_enabled = mEnabled;
-    switch (handle) {
-        case ID_A:
-            new_enabled &= ~M_ACCEL;
-            if (newState)
-                new_enabled |= M_ACCEL;
-            found = 1;
-            break;
-        case ID_G:
-            new_enabled &= ~M_GYRO;
-            if (newState)
-                new_enabled |= M_GYRO;
-            found = 1;
-            break;
-        case ID_PR:
-            new_enabled &= ~M_PRESSURE;
-            if (newState)
-                new_enabled |= M_PRESSURE;
-            found = 1;
-            break;
-        case ID_M:
-        case ID_O:
-            new_enabled &= ~M_ECOMPASS;
-            if (newState)
-                new_enabled |= M_ECOMPASS;
-            else {
-                FILE *fp;
-                int i;
-
-                err = ioctl(dev_fd, MSP430_IOCTL_GET_MAG_CAL, &mMagCal);
-                if (err < 0) {
-                    ALOGE("Can't read Mag Cal data");
-                } else {
-                    if ((fp = fopen(MAG_CAL_FILE, "w")) == NULL) {
-                        ALOGE("Can't open Mag Cal file");
-                    } else {
-                        for (i=0; i<MSP_MAG_CAL_SIZE; i++) {
-                            fputc(mMagCal[i], fp);
-                        }
-                        fclose(fp);
-                    }
-                }
+    if (mFlushAt && now >= mFlushAt) {
+        mFlushAt = 0;
+        // an open transaction flushes at its commit
+        if (!mTxnDepth)
+            err = flushConfig();
+    }
+    if (mRetryAt && now >= mRetryAt) {
+        mRetryAt = 0;
+        // a flush already due or a transaction's commit will do
+        if (!mTxnDepth && !mFlushAt) {
+            stat_inc(mTxnStats.retries);
+            err = flushConfig();
+        }
+    }
+    if (mWatchAt && now >= mWatchAt)
+        watchStreams(now);
+    armTimer();
+    return err;
+}
+
+/*
+ * A stream was enabled or got a new rate: give it a fresh grace period and
+ * make sure the watchdog is ticking.
+ */
+void HubSensor::watchHandle(int32_t handle)
+{
+    if (!mWatchdog || !(hub_sensors[handle].flags & HUB_F_STREAM))
+        return;
+    mWatchSince[handle] = getTimestamp();
+    if (!mWatchAt) {
+        mWatchAt = mWatchSince[handle] + HUB_WATCHDOG_TICK_MS * 1000000LL;
+        armTimer();
+    }
+}
+
+/*
+ * Look for enabled streams silent for HUB_WATCHDOG_PERIODS of their period
+ * and take the next recovery step for them. Runs on every watchdog tick.
+ */
+void HubSensor::watchStreams(int64_t now)
+{
+    const int32_t nowMs = now / 1000000;
+    uint32_t streams = 0, stalled = 0;
+
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if (!(mClients & (1 << handle)) || !(hub_sensors[handle].flags & HUB_F_STREAM))
+            continue;
+        streams |= 1 << handle;
+
+        int64_t silentMs = (now - mWatchSince[handle]) / 1000000;
+        int32_t seen = android_atomic_acquire_load(&mSeenMs[handle]);
+        int32_t seenAgo = int32_t(uint32_t(nowMs) - uint32_t(seen));
+        if (seen && seenAgo < silentMs)
+            silentMs = seenAgo;
+        int64_t periodMs = mDelayNs[handle] / 1000000;
+        if (periodMs < 10)
+            periodMs = 10;
+        if (silentMs > HUB_WATCHDOG_PERIODS * periodMs + HUB_WATCHDOG_GRACE_MS)
+            stalled |= 1 << handle;
+    }
+
+    mWatchAt = streams ? now + HUB_WATCHDOG_TICK_MS * 1000000LL : 0;
+    if (!stalled) {
+        if (mStallStep) {
+            stat_inc(mWatchdogStats.recovered);
+            stat_set(mWatchdogStats.recovery_ms, (now - mStallTime) / 1000000);
+            ALOGE("Sensor streams recovered after %u ms", mWatchdogStats.recovery_ms);
+            mStallStep = 0;
+        }
+        return;
+    }
+
+    if (!mStallStep) {
+        stat_inc(mWatchdogStats.stalls);
+        mStallTime = now;
+    }
+    ALOGE("Sensor streams 0x%x stalled, recovery step %d", stalled, mStallStep);
+    recoverStreams(stalled);
+    // the last step is repeated for as long as the stall lasts
+    if (mStallStep < HUB_WD_NUM_STEPS - 1)
+        mStallStep++;
+
+    // each step gets a full grace period to show an effect
+    now = getTimestamp();
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if (stalled & (1 << handle))
+            mWatchSince[handle] = now;
+    }
+}
+
+/*
+ * Take recovery step mStallStep for the stalled handles, counted and timed.
+ */
+int HubSensor::recoverStreams(uint32_t stalled)
+{
+    const int step = mStallStep;
+    int64_t start = getTimestamp();
+    uint32_t mask = 0, off, on;
+    int err = 0;
+
+    switch (step) {
+        case HUB_WD_REENABLE:
+            for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+                if ((stalled & (1 << handle)) && hub_sensors[handle].bank == HUB_BANK_SENSORS)
+                    mask |= hub_sensors[handle].mask;
             }
-            found = 1;
-            break;
-        case ID_T:
-            new_enabled &= ~M_TEMPERATURE;
-            if (newState)
-                new_enabled |= M_TEMPERATURE;
-            found = 1;
-            break;
-        case ID_L:
-            new_enabled &= ~M_ALS;
-            if (newState)
-                new_enabled |= M_ALS;
-            found = 1;
-            break;
-        case ID_LA:
-            new_enabled &= ~M_LIN_ACCEL;
-            if (newState)
-                new_enabled |= M_LIN_ACCEL;
-            found = 1;
-            break;
-        case ID_Q:
-            new_enabled &= ~M_QUATERNION;
-            if (newState)
-                new_enabled |= M_QUATERNION;
-            found = 1;
-            break;
-        case ID_GR:
-            new_enabled &= ~M_GRAVITY;
-            if (newState)
-                new_enabled |= M_GRAVITY;
-            found = 1;
-            break;
-        case ID_DR:
-            new_enabled &= ~M_DISP_ROTATE;
-            if (newState)
-                new_enabled |= M_DISP_ROTATE;
-            found = 1;
-            break;
-        case ID_DB:
-            new_enabled &= ~M_DISP_BRIGHTNESS;
-            if (newState)
-                new_enabled |= M_DISP_BRIGHTNESS;
-            found = 1;
-            break;
-#if 0
-        case ID_UNCALIB_GYRO:
-            new_enabled &= ~M_UNCALIB_GYRO;
-            if (newState)
-                new_enabled |= M_UNCALIB_GYRO;
-            found = 1;
-            break;
-	case ID_UNCALIB_MAG:
-            new_enabled &= ~M_UNCALIB_MAG;
-            if (newState)
-                new_enabled |= M_UNCALIB_MAG;
-            found = 1;
+            on = mEnabled;
+            off = on & ~mask;
+            stat_inc(mTxnStats.issued);
+            if (hubIoctl(MSP430_IOCTL_SET_SENSORS, &off) < 0) {
+                err = -errno;
+                break;
+            }
+            // the hub has them off until the second write goes through
+            android_atomic_release_store(off, &mEnabled);
+            stat_inc(mTxnStats.issued);
+            if (hubIoctl(MSP430_IOCTL_SET_SENSORS, &on) < 0) {
+                err = -errno;
+                stat_inc(mTxnStats.errors);
+                // mEnabled now differs from what is wanted, a flush rewrites it
+                scheduleRetry();
+                break;
+            }
+            android_atomic_release_store(on, &mEnabled);
             break;
-#endif
-	case ID_STEP_COUNTER:
-            new_enabled &= ~M_STEP_COUNTER;
-            if (newState)
-                new_enabled |= M_STEP_COUNTER;
-            found = 1;
+        case HUB_WD_NORMALMODE: {
+            // the hub reports DT_RESET when it is back, which restores it
+            int dummy = 0;
+            if (hubIoctl(MSP430_IOCTL_NORMALMODE, &dummy) < 0)
+                err = -errno;
             break;
-	case ID_STEP_DETECTOR:
-            new_enabled &= ~M_STEP_DETECTOR;
-            if (newState)
-                new_enabled |= M_STEP_DETECTOR;
-            found = 1;
+        }
+        case HUB_WD_RESTORE:
+            err = restoreState();
             break;
     }
 
-    if (found && (new_enabled != mEnabled)) {
-        err = ioctl(dev_fd, MSP430_IOCTL_SET_SENSORS, &new_enabled);
-        ALOGE_IF(err, "Could not change sensor state (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = new_enabled;
+    stat_inc(mWatchdogStats.steps[step]);
+    stat_set(mWatchdogStats.step_us[step], (getTimestamp() - start) / 1000);
+    ALOGE_IF(err, "Recovery step %d failed (%s)", step, strerror(-err));
+    return err;
+}
+
+/*
+ * Write every hub register whose wanted value differs from the one last
+ * written: at most one ioctl per enable bank and per rate register. A
+ * failed write stays pending and the flush is retried on the timer.
+ */
+int HubSensor::flushConfig()
+{
+    uint32_t groups = mDirtyGroups;
+    uint32_t delays = mDirtyDelays;
+    int err = 0, ret;
+
+    mFlushAt = 0;
+    mRetryAt = 0;
+    mDirtyGroups = 0;
+    mDirtyDelays = 0;
+    stat_inc(mTxnStats.flushes);
+
+    if (mHubStale) {
+        // whatever was written before the reset is gone
+        mHubStale = false;
+        mStaleBanks = (1 << HUB_BANK_SENSORS) | (1 << HUB_BANK_WAKE);
+        memset(mSharedDelay, 0xff, sizeof(mSharedDelay));
+        for (int group = 0; group < HUB_NUM_GROUPS; group++)
+            groups |= 1 << group;
+        delays |= mHwDelayValid;
+        mHwDelayValid = 0;
+    }
+
+    ret = writeEnable(HUB_BANK_SENSORS, mWantEnabled, &mEnabled);
+    if (ret)
+        err = ret;
+    ret = writeEnable(HUB_BANK_WAKE, mWantWake, &mWakeEnabled);
+    if (ret)
+        err = ret;
+
+    for (int group = 0; group < HUB_NUM_GROUPS; group++) {
+        if (!(groups & (1 << group)))
+            continue;
+        ret = updateSharedDelay(group, mDelayExtra);
+        if (ret) {
+            stat_inc(mTxnStats.errors);
+            mDirtyGroups |= 1 << group;
+            err = ret;
         }
     }
+    mDelayExtra = 0;
 
-    new_enabled = mWakeEnabled;
-    found = 0;
-    switch (handle) {
-        case ID_D:
-            new_enabled &= ~M_DOCK;
-            if (newState)
-                new_enabled |= M_DOCK;
-            found = 1;
-            break;
-        case ID_P:
-            new_enabled &= ~M_PROXIMITY;
-            if (newState)
-                new_enabled |= M_PROXIMITY;
-            found = 1;
-            break;
-        case ID_FU:
-            new_enabled &= ~M_FLATUP;
-            if (newState)
-                new_enabled |= M_FLATUP;
-            found = 1;
-            break;
-        case ID_FD:
-            new_enabled &= ~M_FLATDOWN;
-            if (newState)
-                new_enabled |= M_FLATDOWN;
-            found = 1;
-            break;
-        case ID_S:
-            new_enabled &= ~M_STOWED;
-            if (newState)
-                new_enabled |= M_STOWED;
-            found = 1;
-            break;
-        case ID_CA:
-            new_enabled &= ~M_CAMERA_ACT;
-            if (newState)
-                new_enabled |= M_CAMERA_ACT;
-            found = 1;
-            break;
-        case ID_NFC:
-            new_enabled &= ~M_NFC;
-            if (newState)
-                new_enabled |= M_NFC;
-            else {
-                FILE *fp;
-                int i;
-
-                err = ioctl(dev_fd, MSP430_IOCTL_GET_MAG_CAL, &mMagCal);
-                if (err < 0) {
-                    ALOGE("Can't read Mag Cal data");
-                } else {
-                    if ((fp = fopen(MAG_CAL_FILE, "w")) == NULL) {
-                        ALOGE("Can't open Mag Cal file");
-                    } else {
-                        for (i=0; i<MSP_MAG_CAL_SIZE; i++) {
-                            fputc(mMagCal[i], fp);
-                        }
-                        fclose(fp);
-                    }
-                }
-            }
-            found = 1;
-            break;
-        case ID_SIM:
-            ALOGE("Signifigant Motion enabled? %d", newState);
-            new_enabled &= ~M_SIM;
-            if (newState)
-                new_enabled |= M_SIM;
-            found = 1;
-            break;
+    for (int handle = 0; handle < SENSORS_NUM_HANDLES; handle++) {
+        if (!(delays & (1 << handle)))
+            continue;
+        ret = writeDelay(handle);
+        if (ret) {
+            stat_inc(mTxnStats.errors);
+            mDirtyDelays |= 1 << handle;
+            err = ret;
+        }
+    }
+
+    if (err)
+        scheduleRetry();
+    else
+        mRetryMs = 0;
+    return err;
+}
+
+/*
+ * The hub came back from a reset with its defaults: put back the wall
+ * clock, the mag calibration, and every enable mask and rate that was
+ * written before, pending changes included, in one flush.
+ */
+int HubSensor::restoreState()
+{
+    int64_t start = getTimestamp();
+    int err = 0, ret;
+
+    if (mClockSync)
+        err = setHubTime();
+    if (!mCalStore.get(HUB_CAL_MAG, mMagCal, sizeof(mMagCal)) &&
+            hubIoctl(MSP430_IOCTL_SET_MAG_CAL, &mMagCal) < 0) {
+        ALOGE("Can't send Mag Cal data");
+        err = -errno;
+    }
+
+    mHubStale = true;
+    ret = flushConfig();
+    if (ret)
+        err = ret;
+
+    stat_inc(mResetStats.restores);
+    if (err)
+        stat_inc(mResetStats.errors);
+    stat_set(mResetStats.restore_us, (getTimestamp() - start) / 1000);
+    ALOGE("Hub state restored after reset in %u us (%d)", mResetStats.restore_us, err);
+    return err;
+}
+
+/*
+ * Write one enable bank if it differs from what was last applied, or its
+ * register is unknown since a reset. applied only ever holds a value the
+ * hub took.
+ */
+int HubSensor::writeEnable(int bank, uint32_t want, volatile int32_t* applied)
+{
+    int err;
+
+    if (want == (uint32_t)*applied && !(mStaleBanks & (1 << bank)))
+        return 0;
+    err = hubIoctl(bank == HUB_BANK_WAKE ? MSP430_IOCTL_SET_WAKESENSORS :
+            MSP430_IOCTL_SET_SENSORS, &want);
+    stat_inc(mTxnStats.issued);
+    if (err) {
+        ALOGE("Could not change sensor state (%s)", strerror(errno));
+        stat_inc(mTxnStats.errors);
+        return err;
+    }
+    android_atomic_release_store(want, applied);
+    mStaleBanks &= ~(1 << bank);
+    return 0;
+}
+
+int HubSensor::writeDelay(int32_t handle)
+{
+    struct hub_sensor const& desc = hub_sensors[handle];
+    unsigned short delay = int64_t(mDelayNs[handle]) / 1000000;
+    int err;
+
+    if (desc.flags & HUB_F_DELAY_SECONDS) {
+        delay /= 1000; // convert to seconds for pedometer rate
+        if (delay == 0)
+            delay = 1;
+    }
+    if ((mHwDelayValid & (1 << handle)) && mHwDelay[handle] == delay)
+        return 0;
+    err = hubIoctl(desc.delay_ioctl, &delay);
+    stat_inc(mTxnStats.issued);
+    if (!err) {
+        mHwDelay[handle] = delay;
+        mHwDelayValid |= 1 << handle;
+    }
+    return err;
+}
+
+/*
+ * Refill mRecords from the data node. In bulk mode one read() returns as
+ * many records as the driver has queued, up to MSP430_READ_BATCH; records
+ * the caller has no room for stay here and are reported through
+ * hasPendingEvents(). A trailing partial record is kept and completed by
+ * the next read. Returns the number of whole records available, 0 if the
+ * node is empty.
+ */
+int HubSensor::fillRecords()
+{
+    const size_t recSize = sizeof(struct msp430_android_sensor_data);
+    size_t partial = mRecordBytes - mRecordHead * recSize;
+    size_t want;
+    ssize_t ret;
+
+    if (partial && mRecordHead)
+        memmove(mRecords, &mRecords[mRecordHead], partial);
+    mRecordBytes = partial;
+    mRecordHead = 0;
+
+    if (mReader) {
+        // the reader thread only hands out whole records
+        uint64_t t0 = mProfiler.start();
+        ret = mReader->read(mRecords, mBulkRead ? MSP430_READ_BATCH : 1);
+        mProfiler.stop(HUB_PROF_READ, t0);
+        mRecordBytes = ret * recSize;
+        mReadStats.records += ret;
+        captureRecords(0, ret);
+        convertRecords(ret);
+        syncClock(ret);
+        return ret;
+    }
+
+    if (mBulkRead)
+        want = sizeof(mRecords) - mRecordBytes;
+    else
+        want = recSize - mRecordBytes;
+
+    do {
+        uint64_t t0 = mProfiler.start();
+        ret = readData((char *)mRecords + mRecordBytes, want);
+        mProfiler.stop(HUB_PROF_READ, t0);
+        mReadStats.read_calls++;
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        ALOGE_IF(errno != EAGAIN, "read() failed (%s)", strerror(errno));
+        return 0;
     }
 
-    if (found && (new_enabled != mWakeEnabled)) {
-        err = ioctl(dev_fd, MSP430_IOCTL_SET_WAKESENSORS, &new_enabled);
-        ALOGE_IF(err, "Could not change sensor state (%s)", strerror(-err));
-        if (!err) {
-            mWakeEnabled = new_enabled;
+    mRecordBytes += ret;
+    mReadStats.records += mRecordBytes / recSize - partial / recSize;
+    captureRecords(partial / recSize, mRecordBytes / recSize);
+    convertRecords(mRecordBytes / recSize);
+    syncClock(mRecordBytes / recSize);
+    return mRecordBytes / recSize;
+}
+
+/*
+ * Hand the records completed by the last read, [first, last), to the
+ * recorder as the hub sent them.
+ */
+/*
+ * Record to name in HUB_CAPTURE_DIR, on debuggable builds only: the
+ * property can be set from the shell and the file is written as system.
+ */
+void HubSensor::startCapture(const char* name)
+{
+    char debuggable[PROPERTY_VALUE_MAX];
+    char path[PATH_MAX];
+
+    property_get("ro.debuggable", debuggable, "0");
+    if (strcmp(debuggable, "1")) {
+        ALOGE("%s ignored, not a debuggable build", MSP430_CAPTURE_PROPERTY);
+        return;
+    }
+    if (strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+        ALOGE("%s must be a file name, not %s", MSP430_CAPTURE_PROPERTY, name);
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s", HUB_CAPTURE_DIR, name);
+    mRecorder = new HubRecorder(path);
+    if (mRecorder->start()) {
+        delete mRecorder;
+        mRecorder = NULL;
+    }
+}
+
+void HubSensor::captureRecords(int first, int last)
+{
+    if (mRecorder)
+        mRecorder->append(&mRecords[first], last - first);
+}
+
+/*
+ * Correlate the newest of the n records just read with the time it was
+ * read at. Only the newest one is used: it waited least in the driver.
+ */
+void HubSensor::syncClock(int n)
+{
+    mReadTime = getTimestamp();
+    if (!mClockSync)
+        return;
+    for (int i = n - 1; i >= 0; i--) {
+        if (hub_handle_of(mRecords[i].type) >= 0) {
+            mClock.observe(mRecords[i].timestamp, mReadTime);
+            break;
         }
     }
+}
 
+/*
+ * Hand the hub the wall clock time, at start-up and after a hub reset.
+ * Runs on the control thread; the data path restarts its clock fit itself.
+ */
+int HubSensor::setHubTime()
+{
+    struct timespec t;
+    unsigned long posix;
+    int err;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    posix = t.tv_sec;
+    err = hubIoctl(MSP430_IOCTL_SET_POSIX_TIME, &posix);
+    ALOGE_IF(err < 0, "Can't set hub time (%s)", strerror(errno));
     return err;
 }
 
-int HubSensor::setDelay(int32_t handle, int64_t ns)
+void HubSensor::getClockStats(struct hub_clock_stats* stats) const
 {
-    int status = -EINVAL;
+    mClock.getStats(stats);
+}
 
-    if (ns < 0)
-        return -EINVAL;
+void HubSensor::getControlStats(struct hub_control_stats* stats) const
+{
+    mControl.getStats(stats);
+}
+
+void HubSensor::getCalStats(struct hub_cal_stats* stats) const
+{
+    mCalStore.getStats(stats);
+}
+
+void HubSensor::getDiagStats(struct hub_diag_stats* stats) const
+{
+    mDiag.getStats(stats);
+}
+
+void HubSensor::getTxnStats(struct hub_txn_stats* stats) const
+{
+    stat_copy(stats, &mTxnStats, sizeof(*stats));
+}
+
+void HubSensor::getResetStats(struct hub_reset_stats* stats) const
+{
+    stat_copy(stats, &mResetStats, sizeof(*stats));
+}
+
+void HubSensor::getWatchdogStats(struct hub_watchdog_stats* stats) const
+{
+    stat_copy(stats, &mWatchdogStats, sizeof(*stats));
+}
+
+void HubSensor::getHandleStats(int32_t handle, struct hub_handle_stats* stats) const
+{
+    mStats.get(handle, stats);
+}
+
+void HubSensor::getIoctlStats(struct hub_ioctl_stats* stats) const
+{
+    mStats.getIoctlStats(stats);
+}
+
+/*
+ * Everything the HAL counts, for the HUB_STATS_SOCKET dump. Runs on the
+ * stats thread; the counters are read as they are, without stopping their
+ * writers.
+ */
+void HubSensor::dumpStats(void* cookie, HubStatsWriter& w)
+{
+    HubSensor* self = static_cast<HubSensor*>(cookie);
+    struct hub_read_stats rs;
+    struct hub_txn_stats ts;
+    struct hub_reset_stats res;
+    struct hub_watchdog_stats ws;
+    struct hub_control_stats cs;
+    struct hub_clock_stats ck;
+    struct hub_cal_stats cal;
+    struct hub_diag_stats ds;
+    struct hub_reader_stats rd;
+    struct hub_recorder_stats rec;
+
+    self->mStats.dumpHandles(w, android_atomic_acquire_load(&self->mClients));
 
-    unsigned short delay = int64_t(ns) / 1000000;
-    switch (handle) {
-        case ID_A: status = ioctl(dev_fd,  MSP430_IOCTL_SET_ACC_DELAY, &delay);   break;
-        case ID_G: status = ioctl(dev_fd,  MSP430_IOCTL_SET_GYRO_DELAY, &delay);  break;
-        case ID_PR: status = ioctl(dev_fd,  MSP430_IOCTL_SET_PRES_DELAY, &delay); break;
-        case ID_M: /* Mag and orientation get set together */
-        case ID_O: status = ioctl(dev_fd,  MSP430_IOCTL_SET_MAG_DELAY, &delay);   break;
-        case ID_T: status = 0;                                                    break;
-        case ID_L: status = 0;                                                    break;
-        case ID_LA: status = 0;                                                   break;
-        case ID_Q: status = 0;                                                    break;
-        case ID_GR: status = 0;                                                   break;
-        case ID_DR: status = 0;                                                   break;
-        case ID_DB: status = 0;                                                   break;
-        case ID_D: status = 0;                                                    break;
-        case ID_P: status = 0;                                                    break;
-        case ID_FU: status = 0;                                                   break;
-        case ID_FD: status = 0;                                                   break;
-        case ID_S: status = 0;                                                    break;
-        case ID_CA: status = 0;                                                   break;
-        case ID_NFC: status = 0;                                                  break;
-        case ID_SIM: status = 0;                                                  break;
-        case ID_UNCALIB_GYRO: status = ioctl(dev_fd,  MSP430_IOCTL_SET_GYRO_DELAY, &delay); break;
-        case ID_UNCALIB_MAG: status = ioctl(dev_fd,  MSP430_IOCTL_SET_MAG_DELAY, &delay);  break;
-        case ID_STEP_COUNTER:
-		    delay /= 1000; // convert to seconds for pedometer rate
-		    if (delay == 0)
-		        delay = 1;
-		    status = ioctl(dev_fd,  MSP430_IOCTL_SET_STEP_COUNTER_DELAY, &delay);
-		    break;
-        case ID_STEP_DETECTOR:status = 0;                                         break;
+    self->getReadStats(&rs);
+    w.begin("read");
+    w.field("read_calls", rs.read_calls);
+    w.field("records", rs.records);
+    w.field("events", rs.events);
+    w.field("decimated", rs.decimated);
+    w.field("filtered", rs.filtered);
+    w.end();
+
+    if (self->getReaderStats(&rd)) {
+        w.begin("reader");
+        w.field("read_calls", rd.read_calls);
+        w.field("records", rd.records);
+        w.field("overflows", rd.overflows);
+        w.field("occupancy", rd.occupancy);
+        w.field("peak", rd.peak);
+        w.end();
+    }
+
+    self->getResetStats(&res);
+    w.begin("reset");
+    w.field("resets", res.resets);
+    w.field("restores", res.restores);
+    w.field("errors", res.errors);
+    w.field("restore_us", res.restore_us);
+    w.field("first_event_us", res.first_event_us);
+    w.field("max_first_event_us", res.max_first_event_us);
+    w.end();
+
+    self->getWatchdogStats(&ws);
+    w.begin("watchdog");
+    w.field("stalls", ws.stalls);
+    w.field("recovered", ws.recovered);
+    w.field("reenable", ws.steps[HUB_WD_REENABLE]);
+    w.field("normalmode", ws.steps[HUB_WD_NORMALMODE]);
+    w.field("restore", ws.steps[HUB_WD_RESTORE]);
+    w.field("recovery_ms", ws.recovery_ms);
+    w.end();
+
+    self->getTxnStats(&ts);
+    w.begin("txn");
+    w.field("requested", ts.requested);
+    w.field("issued", ts.issued);
+    w.field("flushes", ts.flushes);
+    w.field("errors", ts.errors);
+    w.field("retries", ts.retries);
+    w.end();
+
+    self->mStats.dumpIoctls(w);
+    self->mProfiler.dump(w);
+
+    self->getControlStats(&cs);
+    w.begin("control");
+    w.field("posted", cs.posted);
+    w.field("executed", cs.executed);
+    w.field("full", cs.full);
+    w.field("refused", cs.refused);
+    w.end();
+
+    self->getClockStats(&ck);
+    w.begin("clock");
+    w.field("samples", ck.samples);
+    w.field("resets", ck.resets);
+    w.field("clamped", ck.clamped);
+    w.field("offset_ns", ck.offset_ns);
+    w.field("drift_ppb", ck.drift_ppb);
+    w.field("raw_jitter_ns", ck.raw_jitter_ns);
+    w.field("residual_jitter_ns", ck.residual_jitter_ns);
+    w.end();
+
+    self->getCalStats(&cal);
+    w.begin("cal");
+    w.field("updates", cal.updates);
+    w.field("unchanged", cal.unchanged);
+    w.field("writes", cal.writes);
+    w.field("coalesced", cal.coalesced);
+    w.field("errors", cal.errors);
+    w.end();
+
+    self->getDiagStats(&ds);
+    w.begin("diag");
+    w.field("reported", ds.reported);
+    w.field("limited", ds.limited);
+    w.field("dropped", ds.dropped);
+    w.field("written", ds.written);
+    w.field("errors", ds.errors);
+    w.end();
+
+    if (self->getRecorderStats(&rec)) {
+        w.begin("recorder");
+        w.field("records", rec.records);
+        w.field("dropped", rec.dropped);
+        w.field("blocks", rec.blocks);
+        w.field("bytes", rec.bytes);
+        w.field("errors", rec.errors);
+        w.end();
     }
-    return status;
+}
+
+/*
+ * Gather the triaxial samples of the first n records of mRecords and scale
+ * them to SI units with a single hub_convert_s16() call, so the SIMD kernel
+ * runs over a whole read rather than three lanes at a time. Records of
+ * disabled handles are left out; they are dropped before decoding anyway.
+ */
+void HubSensor::convertRecords(int n)
+{
+    const uint32_t clients = android_atomic_acquire_load(&mClients);
+    uint64_t t0 = mProfiler.start();
+    int lanes = 0;
+
+    for (int i = 0; i < n; i++) {
+        struct msp430_android_sensor_data const& rec = mRecords[i];
+        int handle = hub_handle_of(rec.type);
+
+        mConvIndex[i] = -1;
+        if (handle < 0 || hub_sensors[handle].decoder != HUB_DECODE_VEC3 ||
+                !(clients & (1 << handle)))
+            continue;
+        const float* scale = hub_sensors[handle].scale;
+        mConvIndex[i] = lanes;
+        mRaw[lanes] = MSP16TOH(rec.data1);
+        mRaw[lanes + 1] = MSP16TOH(rec.data2);
+        mRaw[lanes + 2] = MSP16TOH(rec.data3);
+        mScale[lanes] = scale[0];
+        mScale[lanes + 1] = scale[1];
+        mScale[lanes + 2] = scale[2];
+        lanes += 3;
+    }
+    hub_convert_s16(mRaw, mScale, mConverted, lanes);
+    mProfiler.stop(HUB_PROF_CONVERT, t0);
+}
+
+void HubSensor::getReadStats(struct hub_read_stats* stats) const
+{
+    *stats = mReadStats;
+}
+
+bool HubSensor::getReaderStats(struct hub_reader_stats* stats) const
+{
+    if (!mReader)
+        return false;
+    mReader->getStats(stats);
+    return true;
+}
+
+bool HubSensor::getRecorderStats(struct hub_recorder_stats* stats) const
+{
+    if (!mRecorder)
+        return false;
+    mRecorder->getStats(stats);
+    return true;
+}
+
+bool HubSensor::hasPendingRecords() const
+{
+    return mRecordHead < mRecordBytes / sizeof(struct msp430_android_sensor_data);
+}
+
+bool HubSensor::hasPendingEvents() const
+{
+    return mPendingCount || hasPendingRecords() ||
+            (mReader && mReader->hasRecords());
 }
 
 int HubSensor::readEvents(sensors_event_t* data, int count)
 {
     int numEventReceived = 0;
-    struct msp430_android_sensor_data buff;
-    int ret;
-    char timeBuf[32];
-    struct tm* ptm = NULL;
-    struct timeval timeutc;
-    static long int sent_bug2go_sec = 0;
+    int nb, i;
+    uint32_t clients;
 
     if (count < 1)
         return -EINVAL;
-    while (((ret = read(data_fd, &buff, sizeof(struct msp430_android_sensor_data))) != 0)  && count) {
+
+    // the control thread publishes the enable masks; clients that were
+    // just enabled start decimating afresh
+    clients = android_atomic_acquire_load(&mClients);
+    for (i = 0; i < SENSORS_NUM_HANDLES; i++) {
+        if ((clients & ~mSeenClients) & (1 << i))
+            mLastDelivered[i] = 0;
+    }
+    mSeenClients = clients;
+
+    while (count) {
+        if (mPendingCount) {
+            mStats.event(mPendingEvents[mPendingHead].sensor, mReadTime);
+            *data++ = mPendingEvents[mPendingHead];
+            mPendingHead = (mPendingHead + 1) % HUB_PENDING_EVENTS;
+            mPendingCount--;
+            count--;
+            numEventReceived++;
+            continue;
+        }
+
+        if (!hasPendingRecords() && fillRecords() == 0)
+            break;
+
+        const int16_t conv = mConvIndex[mRecordHead];
+        struct msp430_android_sensor_data const& buff = mRecords[mRecordHead++];
+        const float* xyz = conv >= 0 ? &mConverted[conv] : NULL;
+
+        // drop records nobody subscribed to before paying for the decode
+        // (e.g. DT_MAG while only orientation keeps the ecompass running)
+        const int handle = hub_handle_of(buff.type);
+        if (handle >= 0) {
+            mStats.record(handle);
+            if (!(clients & (1 << handle))) {
+                mStats.filtered(handle);
+                mReadStats.filtered++;
+                continue;
+            }
+        }
+
 #ifndef DONTBUGME
-        /* these sensors are not supported, upload a bug2go if its been at least 10mins since previous bug2go*/
+        /* these sensors are not supported, upload a bug2go (rate limited by mDiag) */
         /* remove this if-clause when corruption issue resolved */
 
         if (buff.type == DT_PRESSURE || buff.type == DT_TEMP || buff.type == DT_LIN_ACCEL ||
-            buff.type == DT_GRAVITY || buff.type == DT_DOCK || buff.type == DT_QUATERNION ||
-            buff.type == DT_NFC) {
-            count--;
-            time(&timeutc.tv_sec);
-            if ((sent_bug2go_sec == 0) ||
-                (timeutc.tv_sec - sent_bug2go_sec > 60*10)) {
-                // put timestamp in dropbox file
-                ptm = localtime(&(timeutc.tv_sec));
-                if (ptm != NULL) {
-                    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
-                    capture_dump(timeBuf, buff.type, SENSORHUB_DUMPFILE,
-                        DROPBOX_FLAG_TEXT | DROPBOX_FLAG_GZIP);
-                }
-                sent_bug2go_sec = timeutc.tv_sec;
-            }
+            buff.type == DT_GRAVITY || buff.type == DT_DOCK || buff.type == DT_NFC) {
+            mDiag.report(HUB_DIAG_RECORD, buff.type);
+            mStats.discarded(handle);
             continue;
         }
 #endif
 
-        switch (buff.type) {
-            case DT_ACCEL:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_A;
-                data->type = SENSOR_TYPE_ACCELEROMETER;
-                data->acceleration.x = MSP16TOH(buff.data1) * CONVERT_A_X;
-                data->acceleration.y = MSP16TOH(buff.data2) * CONVERT_A_Y;
-                data->acceleration.z = MSP16TOH(buff.data3) * CONVERT_A_Z;
-                data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_GYRO:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_G;
-                data->type = SENSOR_TYPE_GYROSCOPE;
-                data->gyro.x = MSP16TOH(buff.data1) * CONVERT_G_P;
-                data->gyro.y = MSP16TOH(buff.data2) * CONVERT_G_R;
-                data->gyro.z = MSP16TOH(buff.data3) * CONVERT_G_Y;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-#if 0
-            case DT_UNCALIB_GYRO:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_UNCALIB_GYRO;
-                data->type = SENSOR_TYPE_GYROSCOPE_UNCALIBRATED;
-                data->uncalibrated_gyro.x_uncalib = MSP16TOH(buff.data1) * CONVERT_G_P;
-                data->uncalibrated_gyro.y_uncalib = MSP16TOH(buff.data2) * CONVERT_G_R;
-                data->uncalibrated_gyro.z_uncalib = MSP16TOH(buff.data3) * CONVERT_G_Y;
-                data->uncalibrated_gyro.x_bias = MSP16TOH(buff.data4) * CONVERT_BIAS_G_P;
-                data->uncalibrated_gyro.y_bias = MSP16TOH(buff.data5) * CONVERT_BIAS_G_R;
-                data->uncalibrated_gyro.z_bias = MSP16TOH(buff.data6) * CONVERT_BIAS_G_Y;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_UNCALIB_MAG:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_UNCALIB_MAG;
-                data->type = SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED;
-                data->uncalibrated_magnetic.x_uncalib = MSP16TOH(buff.data1) * CONVERT_M_X;
-                data->uncalibrated_magnetic.y_uncalib = MSP16TOH(buff.data2) * CONVERT_M_Y;
-                data->uncalibrated_magnetic.z_uncalib = MSP16TOH(buff.data3) * CONVERT_M_Z;
-                data->uncalibrated_magnetic.x_bias = MSP16TOH(buff.data4) * CONVERT_BIAS_M_X;
-                data->uncalibrated_magnetic.y_bias = MSP16TOH(buff.data5) * CONVERT_BIAS_M_Y;
-                data->uncalibrated_magnetic.z_bias = MSP16TOH(buff.data6) * CONVERT_BIAS_M_Z;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-#endif
-            case DT_STEP_COUNTER:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_STEP_COUNTER;
-                data->type = SENSOR_TYPE_STEP_COUNTER;
-                data->u64.step_counter =  (
-                        (((uint64_t)MSP16TOH(buff.data4)) << 48) |
-                        (((uint64_t)MSP16TOH(buff.data3)) << 32) |
-                        (((uint64_t)MSP16TOH(buff.data2)) << 16) |
-                        (((uint64_t)MSP16TOH(buff.data1))) );
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_STEP_DETECTOR:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_STEP_DETECTOR;
-                data->type = SENSOR_TYPE_STEP_DETECTOR;
-                data->data[0] = MSP16TOH(buff.data1);
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_PRESSURE:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_PR;
-                data->type = SENSOR_TYPE_PRESSURE;
-                data->pressure = (uint32_t)(((MSP16TOH(buff.data1)) << 16) | ((MSP16TOH(buff.data2) & 0xFFFF)))* CONVERT_B;
-
-
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_MAG:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_M;
-                data->type = SENSOR_TYPE_MAGNETIC_FIELD;
-                data->magnetic.x = MSP16TOH(buff.data1) * CONVERT_M_X;
-                data->magnetic.y = MSP16TOH(buff.data2) * CONVERT_M_Y;
-                data->magnetic.z = MSP16TOH(buff.data3) * CONVERT_M_Z;
-                data->magnetic.status = buff.status;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_ORIENT:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_O;
-                data->type = SENSOR_TYPE_ORIENTATION;
-                data->orientation.azimuth = MSP16TOH(buff.data1) * CONVERT_O_Y;
-                data->orientation.pitch = MSP16TOH(buff.data2) * CONVERT_O_P;
-                // Roll value needs to be negated.
-                data->orientation.roll = -MSP16TOH(buff.data3) * CONVERT_O_R;
-                data->orientation.status = buff.status;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_TEMP:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_T;
-                data->type = SENSOR_TYPE_TEMPERATURE;
-                data->temperature = MSP16TOH(buff.data1) * CONVERT_T;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_ALS:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_L;
-                data->type = SENSOR_TYPE_LIGHT;
-                data->light = (uint16_t)MSP16TOH(buff.data1);
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_LIN_ACCEL:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_LA;
-                data->type = SENSOR_TYPE_LINEAR_ACCELERATION;
-                data->acceleration.x = MSP16TOH(buff.data1) * CONVERT_A_LIN;
-                data->acceleration.y = MSP16TOH(buff.data2) * CONVERT_A_LIN;
-                data->acceleration.z = MSP16TOH(buff.data3) * CONVERT_A_LIN;
-                data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_QUATERNION:
-                ALOGE("Quaternion event unhandled");
-                break;
-            case DT_GRAVITY:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_GR;
-                data->type = SENSOR_TYPE_GRAVITY;
-                data->acceleration.x = MSP16TOH(buff.data1) * CONVERT_A_GRAV;
-                data->acceleration.y = MSP16TOH(buff.data2) * CONVERT_A_GRAV;
-                data->acceleration.z = MSP16TOH(buff.data3) * CONVERT_A_GRAV;
-                data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_DISP_ROTATE:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_DR;
-                data->type = SENSOR_TYPE_DISPLAY_ROTATE;
-                if (buff.data1 == DISP_FLAT)
-                    data->data[0] = DISP_UNKNOWN;
-                else
-                    data->data[0] = buff.data1;
-
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_DISP_BRIGHT:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_DB;
-                data->type = SENSOR_TYPE_DISPLAY_BRIGHTNESS;
-                data->data[0] = buff.data1;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_DOCK:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_D;
-                data->type = SENSOR_TYPE_DOCK;
-                data->data[0] = buff.data1;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_PROX:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_P;
-                data->type = SENSOR_TYPE_PROXIMITY;
-                if (buff.data1 == 0) {
-                    data->distance = PROX_UNCOVERED;
-                    ALOGE("Proximity uncovered");
-		} else if (buff.data1 == 1) {
-                    data->distance = PROX_COVERED;
-                    ALOGE("Proximity covered 1");
+        uint64_t t0 = mProfiler.start();
+        if (count >= HUB_MAX_EVENTS_PER_RECORD) {
+            nb = decimate(data, decodeRecord(buff, xyz, data));
+            for (i = 0; i < nb; i++)
+                mStats.event(data[i].sensor, mReadTime);
+            data += nb;
+            count -= nb;
+            numEventReceived += nb;
+        } else {
+            // Not enough room left for the worst case: decode aside and
+            // keep whatever does not fit for the next call.
+            sensors_event_t scratch[HUB_MAX_EVENTS_PER_RECORD];
+            nb = decimate(scratch, decodeRecord(buff, xyz, scratch));
+            for (i = 0; i < nb; i++) {
+                if (count) {
+                    mStats.event(scratch[i].sensor, mReadTime);
+                    *data++ = scratch[i];
+                    count--;
+                    numEventReceived++;
                 } else {
-                    data->distance = PROX_SATURATED;
-                    ALOGE("Proximity covered 2");
+                    mPendingEvents[(mPendingHead + mPendingCount) % HUB_PENDING_EVENTS] = scratch[i];
+                    mPendingCount++;
                 }
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_FLAT_UP:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_FU;
-                data->type = SENSOR_TYPE_FLAT_UP;
-                if (buff.data1 == 0x01)
-                    data->data[0] = FLAT_DETECTED;
-                else
-                    data->data[0] = FLAT_NOTDETECTED;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_FLAT_DOWN:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_FD;
-                data->type = SENSOR_TYPE_FLAT_DOWN;
-                if (buff.data1 == 0x02)
-                    data->data[0] = FLAT_DETECTED;
-                else
-                    data->data[0] = FLAT_NOTDETECTED;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_STOWED:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_S;
-                data->type = SENSOR_TYPE_STOWED;
-                data->data[0] = buff.data1;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_CAMERA_ACT:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_CA;
-                data->type = SENSOR_TYPE_CAMERA_ACTIVATE;
-                data->data[0] = MSP430_CAMERA_DATA;
-                data->data[1] = MSP16TOH(buff.data1);
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_NFC:
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_NFC;
-                data->type = SENSOR_TYPE_NFC_DETECT;
-                data->data[0] = buff.data1;
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                break;
-            case DT_SIM:
-		ALOGE("Signifigant Motion Event");
-                data->version = SENSORS_EVENT_T_SIZE;
-                data->sensor = ID_SIM;
-                data->type = SENSOR_TYPE_SIGNIFICANT_MOTION;
-                data->data[0] = MSP16TOH(buff.data1);
-                data->timestamp = buff.timestamp;
-                data++;
-                count--;
-                numEventReceived++;
-                enable(ID_SIM, 0);
-                break;
-            case DT_RESET:
-                count--;
-#ifndef DONTBUGME
-                // put timestamp in dropbox file
-                time(&timeutc.tv_sec);
-                ptm = localtime(&(timeutc.tv_sec));
-                if (ptm != NULL) {
-                    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
-                    capture_dump(timeBuf, buff.data1, SENSORHUB_DUMPFILE,
-                         DROPBOX_FLAG_TEXT | DROPBOX_FLAG_GZIP);
-                }
-#endif
-                break;
-            default:
-                ALOGE("Default case %x event unhandled", buff.type);
-                break;
+            }
         }
+        mProfiler.stop(HubProfiler::decodeHist(buff.type), t0);
     }
 
+    mReadStats.events += numEventReceived;
     return numEventReceived;
 }
 
-gzFile HubSensor::open_dropbox_file(const char* timestamp, const char* dst, const int flags)
+/*
+ * Thin out events of shared sensors whose client asked for a slower rate
+ * than the hub is running at, keeping them at least the interval published
+ * by publishDecimation() apart. Returns the number of events left in data.
+ */
+int HubSensor::decimate(sensors_event_t* data, int nb)
 {
-    char dropbox_path[128];
-    pid_t pid = getpid();
+    int kept = 0;
 
-    snprintf(dropbox_path, sizeof(dropbox_path), "%s/%s:%d:%u-%s",
-             DROPBOX_DIR, DROPBOX_TAG, flags, pid, timestamp);
-    ALOGD("msp430 - dumping to dropbox file[%s]...\n", dropbox_path);
+    for (int i = 0; i < nb; i++) {
+        int handle = data[i].sensor;
 
-    return gzopen(dropbox_path, "wb");
+        if (handle >= 0 && handle < SENSORS_NUM_HANDLES &&
+                hub_sensors[handle].group != HUB_GROUP_NONE) {
+            int64_t interval = android_atomic_acquire_load(&mDecimateUs[handle]) * 1000LL;
+            if (interval && mLastDelivered[handle] &&
+                    data[i].timestamp - mLastDelivered[handle] < interval) {
+                mStats.decimated(handle);
+                mReadStats.decimated++;
+                continue;
+            }
+            mLastDelivered[handle] = data[i].timestamp;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    return kept;
 }
 
-short HubSensor::capture_dump(char* timestamp, const int id, const char* dst, const int flags)
+/*
+ * Convert one hub record into sensors_event_t, returns the number of events
+ * written to data (at most HUB_MAX_EVENTS_PER_RECORD). xyz holds the record's
+ * triaxial samples already scaled by convertRecords(), or NULL if it was not
+ * converted ahead.
+ */
+int HubSensor::decodeRecord(struct msp430_android_sensor_data const& buff,
+        const float* xyz, sensors_event_t* data)
 {
-    char buffer[COPYSIZE] = {0};
-    int rc = 0;
-    gzFile dropbox_file = NULL;
+    int handle = hub_handle_of(buff.type);
+    float local[3];
+    int nb;
 
-    dropbox_file = open_dropbox_file(timestamp, dst, flags);
-    if(dropbox_file == NULL) {
-        ALOGE("ERROR! unable to open dropbox file[errno:%d(%s)]\n", errno, strerror(errno));
-    } else {
-        // put timestamp in dropbox file
-        rc = snprintf(buffer, COPYSIZE, "timestamp:%s\n", timestamp);
-        gzwrite(dropbox_file, buffer, rc);
-        rc = snprintf(buffer, COPYSIZE, "reason:%02d\n", id);
-        gzwrite(dropbox_file, buffer, rc);
-        gzclose(dropbox_file);
-        // to commit buffer cache to disk
-        sync();
+    if (handle < 0) {
+        // hub housekeeping, not tied to any sensor
+        if (buff.type == DT_RESET) {
+            // the hub clock may have been re-based
+            if (mClockSync)
+                mClock.reset();
+            if (mControl.post(HUB_CMD_RESTORE, 0, 0) < 0) {
+                ALOGE("Control queue full, hub restore deferred");
+                android_atomic_release_store(1, &mDeferRestore);
+                mControl.wakeup();
+            }
+            stat_inc(mResetStats.resets);
+            mResetTime = mReadTime;
+            mDiag.report(HUB_DIAG_RESET, buff.data1);
+        } else {
+            ALOGE("Default case %x event unhandled", buff.type);
+        }
+        return 0;
     }
 
-    return 0;
+    struct hub_sensor const& desc = hub_sensors[handle];
+    if (desc.decoder == HUB_DECODE_VEC3 && !xyz) {
+        const int16_t raw[3] = {
+            MSP16TOH(buff.data1), MSP16TOH(buff.data2), MSP16TOH(buff.data3)
+        };
+        hub_convert_s16(raw, desc.scale, local, 3);
+        xyz = local;
+    }
+
+    data->version = SENSORS_EVENT_T_SIZE;
+    data->sensor = handle;
+    data->type = desc.type;
+    data->timestamp = mClockSync ?
+            mClock.toMonotonic(handle, buff.timestamp, mReadTime) : buff.timestamp;
+    nb = sDecoders[desc.decoder](desc, buff, xyz, data);
+
+    if (nb)
+        android_atomic_release_store(int32_t(mReadTime / 1000000), &mSeenMs[handle]);
+    if (nb && mResetTime) {
+        stat_set(mResetStats.first_event_us, (mReadTime - mResetTime) / 1000);
+        if (mResetStats.first_event_us > mResetStats.max_first_event_us)
+            stat_set(mResetStats.max_first_event_us, mResetStats.first_event_us);
+        mResetTime = 0;
+    }
+
+    if (nb && (desc.flags & HUB_F_ONE_SHOT)) {
+        ALOGE("Signifigant Motion Event");
+        if (mControl.post(HUB_CMD_ENABLE, handle, 0) < 0) {
+            ALOGE("Control queue full, disable of %d deferred", handle);
+            android_atomic_or(1 << handle, &mDeferDisable);
+            mControl.wakeup();
+        }
+    }
+    return nb;
 }
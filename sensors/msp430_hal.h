@@ -22,7 +22,6 @@
 #include <endian.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
-#include <zlib.h>
 #include <time.h>
 #include <private/android_filesystem_config.h>
 
@@ -30,20 +29,60 @@
 
 #include "nusensors.h"
 #include "SensorBase.h"
+#include "HubBackend.h"
+#include "HubCalStore.h"
+#include "HubClock.h"
+#include "HubControl.h"
+#include "HubDiag.h"
+#include "HubProfiler.h"
+#include "HubReader.h"
+#include "HubRecorder.h"
+#include "HubStats.h"
+#include "hub_sensors.h"
 
 /*****************************************************************************/
 
 #define SENSORS_EVENT_T_SIZE sizeof(sensors_event_t);
+// Mag calibration as written before HUB_CAL_FILE, imported once.
 #define MAG_CAL_FILE "/data/misc/akmd_set.txt"
-#define DROPBOX_DIR "/data/system/dropbox-add"
-#define DROPBOX_TAG "SENSOR_HUB"
-#define SENSORHUB_DUMPFILE  "sensor_hub"
-#define DROPBOX_FLAG_TEXT        2
-#define DROPBOX_FLAG_GZIP        4
-#define COPYSIZE 256
 
 #define MSP430_CAMERA_DATA 0x01
 
+// Number of hub records pulled from the data node by one read() in bulk mode.
+#define MSP430_READ_BATCH 32
+#define MSP430_BULK_READ_PROPERTY "ro.sensors.msp430.bulk_read"
+#define MSP430_READER_THREAD_PROPERTY "ro.sensors.msp430.reader_thread"
+#define MSP430_CLOCK_SYNC_PROPERTY "ro.sensors.msp430.clock_sync"
+// How long enable/rate changes are gathered before they go to the hub, 0
+// applies each one as it comes.
+#define MSP430_TXN_WINDOW_PROPERTY "ro.sensors.msp430.txn_window_ms"
+#define MSP430_WATCHDOG_PROPERTY "ro.sensors.msp430.watchdog"
+
+// Rate of a sensor enabled before any setDelay(), SENSOR_DELAY_NORMAL.
+#define HUB_DEFAULT_DELAY_NS    200000000LL
+
+// A HUB_F_STREAM sensor is stalled once it has been silent for this many of
+// its periods plus the grace time, checked every tick while one is enabled.
+#define HUB_WATCHDOG_PERIODS    8
+#define HUB_WATCHDOG_GRACE_MS   500
+#define HUB_WATCHDOG_TICK_MS    250
+
+// A flush that failed to write is run again after this, doubling up to the
+// maximum for as long as it keeps failing.
+#define HUB_RETRY_MIN_MS        100
+#define HUB_RETRY_MAX_MS        6400
+
+// Recovery steps of the watchdog, taken in this order.
+#define HUB_WD_REENABLE         0   // switch the stalled sensors off and on
+#define HUB_WD_NORMALMODE       1   // reset the hub with MSP430_IOCTL_NORMALMODE
+#define HUB_WD_RESTORE          2   // rewrite the whole configuration
+#define HUB_WD_NUM_STEPS        3
+
+// Upper bound of events decoded from a single hub record, and room kept for
+// decoded events the framework had no space for in its poll() buffer.
+#define HUB_MAX_EVENTS_PER_RECORD 1
+#define HUB_PENDING_EVENTS 8
+
 // Defines for offsets into the sensorhub event data.
 #define ACCEL_X (0 * sizeof(int16_t))
 #define ACCEL_Y (1 * sizeof(int16_t))
@@ -125,25 +164,191 @@
 #define MSP16TOH(p) (int16_t) (p) //be16toh(p)
 #define MSP32TOH(p) (int32_t) (p) //be32toh(p)
 
+// Commands run by the control thread, see HubSensor::controlHandler().
+#define HUB_CMD_ENABLE          0   // handle, arg: enabled
+#define HUB_CMD_SET_DELAY       1   // handle, arg: delay in ns
+#define HUB_CMD_LOAD_MAG_CAL    2
+#define HUB_CMD_SET_TIME        3
+#define HUB_CMD_BEGIN           4
+#define HUB_CMD_COMMIT          5
+#define HUB_CMD_RESTORE         6   // replay the configuration after a hub reset
+
 struct input_event;
 
+// Stalled streams and what it took to get them going, see
+// HubSensor::getWatchdogStats(). Written by the control thread.
+struct hub_watchdog_stats {
+    uint32_t stalls;                    // episodes detected
+    uint32_t recovered;                 // episodes that ended with data flowing again
+    uint32_t steps[HUB_WD_NUM_STEPS];   // recovery steps taken, by HUB_WD_*
+    uint32_t step_us[HUB_WD_NUM_STEPS]; // duration of the last step of each kind
+    uint32_t recovery_ms;               // detection to data flowing, last episode
+};
+
+// Hub resets and how long sensors were out, see HubSensor::getResetStats().
+struct hub_reset_stats {
+    // written by the data path
+    uint32_t resets;            // DT_RESET records seen
+    uint32_t first_event_us;    // DT_RESET to the next sensor event, last reset
+    uint32_t max_first_event_us;
+    // written by the control thread
+    uint32_t restores;          // configuration replays completed
+    uint32_t errors;            // replays with an ioctl that failed
+    uint32_t restore_us;        // duration of the last replay
+};
+
+// Hub register writes, see HubSensor::getTxnStats(). requested - issued is
+// the number of I2C transactions saved by gathering changes. Written by the
+// control thread.
+struct hub_txn_stats {
+    uint32_t requested;     // writes enable()/setDelay() would have issued one by one
+    uint32_t issued;        // enable and rate ioctls actually sent to the hub
+    uint32_t flushes;       // times the gathered changes were applied
+    uint32_t errors;        // ioctls that failed, retried with the next flush
+    uint32_t retries;       // flushes run again on a timer after a failure
+};
+
+// Cost of the data path in syscalls, see HubSensor::getReadStats().
+struct hub_read_stats {
+    uint32_t read_calls;    // read() syscalls issued on the data node
+    uint32_t records;       // msp430_android_sensor_data records returned
+    uint32_t events;        // sensors_event_t delivered to the framework
+    uint32_t decimated;     // events of shared sensors thinned to the client rate
+    uint32_t filtered;      // records skipped undecoded, their handle is disabled
+};
+
 class HubSensor : public SensorBase {
 public:
-            HubSensor();
+            HubSensor(HubBackend* backend = NULL);
     virtual ~HubSensor();
 
     virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual int getFd() const;
+
+    int beginUpdate();
+    int commitUpdate();
+
+    void getReadStats(struct hub_read_stats* stats) const;
+    bool getReaderStats(struct hub_reader_stats* stats) const;
+    bool getRecorderStats(struct hub_recorder_stats* stats) const;
+    void getClockStats(struct hub_clock_stats* stats) const;
+    void getControlStats(struct hub_control_stats* stats) const;
+    void getCalStats(struct hub_cal_stats* stats) const;
+    void getDiagStats(struct hub_diag_stats* stats) const;
+    void getTxnStats(struct hub_txn_stats* stats) const;
+    void getResetStats(struct hub_reset_stats* stats) const;
+    void getWatchdogStats(struct hub_watchdog_stats* stats) const;
+    void getHandleStats(int32_t handle, struct hub_handle_stats* stats) const;
+    void getIoctlStats(struct hub_ioctl_stats* stats) const;
+    // NULL unless the stages are being timed
+    HubProfiler* getProfiler() { return mProfiler.enabled() ? &mProfiler : NULL; }
+
+protected:
+    HubBackend* getBackend() const { return mBackend; }
 
 private:
+    int hubIoctl(unsigned int cmd, void* arg);
+    ssize_t readData(void* buf, size_t len);
     int update_delay();
-    uint32_t mEnabled;
-    uint32_t mWakeEnabled;
+    static int controlHandler(void* cookie, struct hub_command const& cmd);
+    static void dumpStats(void* cookie, HubStatsWriter& w);
+    int doEnable(int32_t handle, int en);
+    int doSetDelay(int32_t handle, int64_t ns);
+    int scheduleFlush();
+    void scheduleRetry();
+    int armTimer();
+    int onTimer();
+    int runDeferred();
+    void watchHandle(int32_t handle);
+    void watchStreams(int64_t now);
+    int recoverStreams(uint32_t stalled);
+    int flushConfig();
+    int writeEnable(int bank, uint32_t want, volatile int32_t* applied);
+    int restoreState();
+    int writeDelay(int32_t handle);
+    void loadMagCal();
+    void saveMagCal();
+    int setHubTime();
+    // written by the control thread only, read anywhere
+    volatile int32_t mEnabled;
+    volatile int32_t mWakeEnabled;
     uint32_t mPendingMask;
     uint8_t mMagCal[MSP_MAG_CAL_SIZE];
-    gzFile open_dropbox_file(const char* timestamp, const char* dst, const int flags);
-    short capture_dump(char* timestamp, const int id, const char* dst, const int flags);
+    int fillRecords();
+    bool hasPendingRecords() const;
+    int decodeRecord(struct msp430_android_sensor_data const& buff, const float* xyz,
+            sensors_event_t* data);
+    void convertRecords(int n);
+    void syncClock(int n);
+    void startCapture(const char* name);
+    void captureRecords(int first, int last);
+    bool mBulkRead;
+    HubBackend* mBackend;       // owned, NULL when on the device nodes
+    HubReader* mReader;
+    HubRecorder* mRecorder;     // raw stream capture, NULL unless asked for
+    struct msp430_android_sensor_data mRecords[MSP430_READ_BATCH];
+    size_t mRecordBytes;
+    size_t mRecordHead;
+    // data1..3 of the triaxial records in mRecords, converted in one pass
+    int16_t mRaw[MSP430_READ_BATCH * 3];
+    float mScale[MSP430_READ_BATCH * 3];
+    float mConverted[MSP430_READ_BATCH * 3];
+    int16_t mConvIndex[MSP430_READ_BATCH];
+    struct hub_read_stats mReadStats;
+    sensors_event_t mPendingEvents[HUB_PENDING_EVENTS];
+    int mPendingHead;
+    int mPendingCount;
+    volatile int32_t mClients;  // written by the control thread only
+    int64_t mDelayNs[SENSORS_NUM_HANDLES];
+    int64_t mLastDelivered[SENSORS_NUM_HANDLES];
+    unsigned short mSharedDelay[HUB_NUM_GROUPS];
+    bool mClockSync;
+    HubClock mClock;
+    int64_t mReadTime;          // CLOCK_MONOTONIC of the last fill
+    volatile int32_t mDecimateUs[SENSORS_NUM_HANDLES];
+    uint32_t mSeenClients;      // mClients as last seen by readEvents()
+    // configuration asked for but not yet written, control thread only
+    uint32_t mWantEnabled;
+    uint32_t mWantWake;
+    unsigned short mWantShared[HUB_NUM_GROUPS];
+    uint32_t mDirtyGroups;
+    uint32_t mDirtyDelays;
+    uint32_t mDelayExtra;       // handles whose rate was set before enabling
+    unsigned short mHwDelay[SENSORS_NUM_HANDLES];
+    uint32_t mHwDelayValid;
+    int mTxnDepth;
+    int mTxnWindowMs;
+    int64_t mFlushAt;           // end of the transaction window, 0 if none
+    bool mHubStale;             // hub lost its configuration, rewrite it all
+    uint32_t mStaleBanks;       // 1 << HUB_BANK_* of enable registers to write regardless
+    int64_t mRetryAt;           // flush retry after a failed write, 0 if none
+    int mRetryMs;               // its backoff, 0 once a flush went through
+    struct hub_txn_stats mTxnStats;
+    int64_t mResetTime;         // mReadTime of a DT_RESET awaiting its first event
+    struct hub_reset_stats mResetStats;
+    // stall watchdog, control thread only but for mSeenMs
+    bool mWatchdog;
+    int64_t mWatchAt;           // next check, 0 while no stream is enabled
+    int64_t mWatchSince[SENSORS_NUM_HANDLES];
+    volatile int32_t mSeenMs[SENSORS_NUM_HANDLES];  // last event, written by the data path
+    int mStallStep;             // next recovery step, 0 when not stalled
+    int64_t mStallTime;
+    struct hub_watchdog_stats mWatchdogStats;
+    HubCalStore mCalStore;
+    HubDiag mDiag;
+    HubControl mControl;
+    // commands the data path couldn't post, run on HUB_CONTROL_WAKEUP
+    volatile int32_t mDeferRestore;
+    volatile int32_t mDeferDisable;     // one-shot handles to switch off
+    HubStats mStats;
+    HubProfiler mProfiler;
+    unsigned short sharedDelay(int group, uint32_t clients, int* delay_ioctl) const;
+    int updateSharedDelay(int group, uint32_t extra);
+    void publishDecimation(int group);
+    int decimate(sensors_event_t* data, int nb);
 };
 
 /*****************************************************************************/
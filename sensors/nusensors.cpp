@@ -19,94 +19,168 @@
 #include <errno.h>
 #include <dirent.h>
 #include <math.h>
+#include <stdlib.h>
 
 #include <poll.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include <sys/select.h>
 
 #include "nusensors.h"
 #include "msp430_hal.h"
+#include "SensorFifo.h"
 
 /*****************************************************************************/
 
 struct sensors_poll_context_t {
-    struct sensors_poll_device_t device; // must be first
+    struct sensors_poll_device_1 device; // must be first
 
-        sensors_poll_context_t();
+        sensors_poll_context_t(hw_module_t const* module, HubBackend* backend);
         ~sensors_poll_context_t();
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
     int pollEvents(sensors_event_t* data, int count);
+    int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
+    int flush(int handle);
 
 private:
     enum {
         accelgyromag    = 0,
         numSensorDrivers,
+        numFds,
     };
 
+    static const size_t wake = numFds - 1;
+    static const char WAKE_MESSAGE = 'W';
+    struct pollfd mPollFds[numFds];
+    int mWritePipeFd;
     SensorBase* mSensors[numSensorDrivers];
-    struct pollfd mPollFds[numSensorDrivers];
+    HubProfiler* mProfiler;     // NULL unless the hub times its stages
+
+    // batching configuration, written by the framework's binder threads
+    pthread_mutex_t mBatchLock;
+    int64_t mLatency[SENSORS_NUM_HANDLES];
+    volatile int32_t mBatchGeneration;
+    volatile int32_t mEnabledMask;
+    volatile int32_t mFlushPending[SENSORS_NUM_HANDLES];
+    int mFifoSize[SENSORS_NUM_HANDLES];
+    uint32_t mOneShotMask;
+
+    // batching state, owned by the poll thread
+    int32_t mBatchSeen;
+    int64_t mActiveLatency[SENSORS_NUM_HANDLES];
+    SensorFifo* mFifos[SENSORS_NUM_HANDLES];
+
+    void wakePoll();
+    void syncBatchConfig();
+    int routeBatched(sensors_event_t* data, int nb, int64_t now);
+    int drainBatched(sensors_event_t* data, int count, int64_t now);
+    int batchTimeout(int64_t now) const;
 
     int handleToDriver(int handle) const {
-        switch (handle) {
-            case ID_A:
-            case ID_G:
-            case ID_PR:
-            case ID_M:
-            case ID_O:
-            case ID_T:
-            case ID_L:
-            case ID_LA:
-            case ID_Q:
-            case ID_GR:
-            case ID_DR:
-            case ID_DB:
-            case ID_D:
-            case ID_P:
-            case ID_FU:
-            case ID_FD:
-            case ID_S:
-            case ID_CA:
-            case ID_NFC:
-            case ID_IR_GESTURE:
-            case ID_IR_RAW:
-            case ID_SIM:
-            case ID_STEP_DETECTOR:
-            case ID_STEP_COUNTER:
-            case ID_UNCALIB_GYRO:
-            case ID_UNCALIB_MAG:
-                return accelgyromag;
-        }
-        return -EINVAL;
+        // every handle of hub_sensors.h is served by the hub
+        if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+            return -EINVAL;
+        return accelgyromag;
     }
 };
 
 /*****************************************************************************/
 
-sensors_poll_context_t::sensors_poll_context_t()
+sensors_poll_context_t::sensors_poll_context_t(hw_module_t const* module,
+        HubBackend* backend)
+    : mBatchGeneration(0),
+      mEnabledMask(0),
+      mOneShotMask(0),
+      mBatchSeen(0)
 {
-    mSensors[accelgyromag] = new HubSensor();
+    struct sensor_t const* list;
+    // a harness may feed the HAL itself
+    HubSensor* hub = backend ? new HubSensor(backend) : new HubSensor();
+    int i, n;
+
+    mSensors[accelgyromag] = hub;
+    mProfiler = hub->getProfiler();
     mPollFds[accelgyromag].fd = mSensors[accelgyromag]->getFd();
     mPollFds[accelgyromag].events = POLLIN;
     mPollFds[accelgyromag].revents = 0;
+
+    int wakeFds[2];
+    int result = pipe(wakeFds);
+    ALOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
+    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+    mWritePipeFd = wakeFds[1];
+
+    mPollFds[wake].fd = wakeFds[0];
+    mPollFds[wake].events = POLLIN;
+    mPollFds[wake].revents = 0;
+
+    pthread_mutex_init(&mBatchLock, NULL);
+    for (i = 0; i < SENSORS_NUM_HANDLES; i++) {
+        mLatency[i] = 0;
+        mActiveLatency[i] = 0;
+        mFlushPending[i] = 0;
+        mFifoSize[i] = 0;
+        mFifos[i] = NULL;
+    }
+
+    // FIFO depth and reporting mode come from the advertised sensor list
+    n = ((struct sensors_module_t*)module)->get_sensors_list(
+            (struct sensors_module_t*)module, &list);
+    for (i = 0; i < n; i++) {
+        int handle = list[i].handle - SENSORS_HANDLE_BASE;
+        if (handle < 0 || handle >= SENSORS_NUM_HANDLES)
+            continue;
+        mFifoSize[handle] = list[i].fifoMaxEventCount;
+        if (list[i].minDelay < 0)
+            mOneShotMask |= 1 << handle;
+    }
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     for (int i=0 ; i<numSensorDrivers ; i++) {
         delete mSensors[i];
     }
+    for (int i=0 ; i<SENSORS_NUM_HANDLES ; i++) {
+        delete mFifos[i];
+    }
+    close(mPollFds[wake].fd);
+    close(mWritePipeFd);
+    pthread_mutex_destroy(&mBatchLock);
+}
+
+void sensors_poll_context_t::wakePoll() {
+    const char wakeMessage(WAKE_MESSAGE);
+    int result = write(mWritePipeFd, &wakeMessage, 1);
+    ALOGE_IF(result<0 && errno != EAGAIN, "error sending wake message (%s)", strerror(errno));
 }
 
 int sensors_poll_context_t::activate(int handle, int enabled) {
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->enable(handle, enabled);
+    int err = mSensors[index]->enable(handle, enabled);
+    if (!err) {
+        if (enabled) {
+            android_atomic_or(1 << handle, &mEnabledMask);
+        } else {
+            android_atomic_and(~(1 << handle), &mEnabledMask);
+            // hand whatever is still batched to the framework
+            pthread_mutex_lock(&mBatchLock);
+            mLatency[handle] = 0;
+            pthread_mutex_unlock(&mBatchLock);
+            android_atomic_inc(&mBatchGeneration);
+            wakePoll();
+        }
+    }
+    return err;
 }
 
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
@@ -115,24 +189,224 @@ int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
     return mSensors[index]->setDelay(handle, ns);
 }
 
+int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns, int64_t timeout)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+
+    if (timeout < 0 || period_ns < 0)
+        return -EINVAL;
+    if (timeout > 0 && !mFifoSize[handle]) {
+        // no FIFO behind this sensor: report it, then stream
+        if (flags & SENSORS_BATCH_DRY_RUN)
+            return -EINVAL;
+        timeout = 0;
+    }
+    if (flags & SENSORS_BATCH_DRY_RUN)
+        return 0;
+
+    int err = mSensors[index]->setDelay(handle, period_ns);
+    if (err)
+        return err;
+
+    pthread_mutex_lock(&mBatchLock);
+    mLatency[handle] = timeout;
+    pthread_mutex_unlock(&mBatchLock);
+    android_atomic_inc(&mBatchGeneration);
+    wakePoll();
+    return 0;
+}
+
+int sensors_poll_context_t::flush(int handle)
+{
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+
+    if (!(android_atomic_acquire_load(&mEnabledMask) & (1 << handle)))
+        return -EINVAL;
+    if (mOneShotMask & (1 << handle))
+        return -EINVAL;
+
+    android_atomic_inc(&mFlushPending[handle]);
+    wakePoll();
+    return 0;
+}
+
+/*
+ * Pick up latency changes made by batch()/activate(). The lock is only
+ * taken when the generation moved, so the poll loop stays lock free.
+ */
+void sensors_poll_context_t::syncBatchConfig()
+{
+    int32_t generation = android_atomic_acquire_load(&mBatchGeneration);
+    int i;
+
+    if (generation == mBatchSeen)
+        return;
+
+    pthread_mutex_lock(&mBatchLock);
+    for (i = 0; i < SENSORS_NUM_HANDLES; i++)
+        mActiveLatency[i] = mLatency[i];
+    pthread_mutex_unlock(&mBatchLock);
+    mBatchSeen = generation;
+
+    for (i = 0; i < SENSORS_NUM_HANDLES; i++) {
+        if (mActiveLatency[i] && !mFifos[i])
+            mFifos[i] = new SensorFifo(mFifoSize[i]);
+    }
+}
+
+/*
+ * Move events of batched sensors out of data into their FIFO and compact
+ * the rest; returns the number of events left in data. A sensor that just
+ * stopped batching keeps going through its FIFO until it is empty so its
+ * events stay in order.
+ */
+int sensors_poll_context_t::routeBatched(sensors_event_t* data, int nb, int64_t now)
+{
+    int kept = 0;
+
+    for (int i=0 ; i<nb ; i++) {
+        int handle = data[i].sensor;
+        SensorFifo* fifo = (handle >= 0 && handle < SENSORS_NUM_HANDLES) ?
+                mFifos[handle] : NULL;
+        if (fifo && (mActiveLatency[handle] || !fifo->empty())) {
+            fifo->push(data[i], now);
+            continue;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    return kept;
+}
+
+/*
+ * Deliver FIFOs whose latency expired, that are filling up or that have a
+ * flush pending, followed by one META_DATA_FLUSH_COMPLETE per flush() once
+ * the sensor's FIFO is empty.
+ */
+int sensors_poll_context_t::drainBatched(sensors_event_t* data, int count, int64_t now)
+{
+    int nb = 0;
+
+    for (int handle=0 ; count && handle<SENSORS_NUM_HANDLES ; handle++) {
+        SensorFifo* fifo = mFifos[handle];
+        int32_t flushes = android_atomic_acquire_load(&mFlushPending[handle]);
+
+        if (fifo && !fifo->empty() && (flushes || !mActiveLatency[handle] ||
+                fifo->nearlyFull() || now - fifo->oldest() >= mActiveLatency[handle])) {
+            int n = fifo->pop(data + nb, count);
+            nb += n;
+            count -= n;
+            if (!fifo->empty())
+                break;
+        }
+
+        while (flushes && count) {
+            sensors_meta_data_event_t* meta = data + nb;
+            memset(meta, 0, sizeof(*meta));
+            meta->version = META_DATA_VERSION;
+            meta->type = SENSOR_TYPE_META_DATA;
+            meta->sensor = 0;
+            meta->timestamp = 0;
+            meta->meta_data.what = META_DATA_FLUSH_COMPLETE;
+            meta->meta_data.sensor = handle;
+            android_atomic_dec(&mFlushPending[handle]);
+            flushes--;
+            nb++;
+            count--;
+        }
+    }
+    return nb;
+}
+
+/*
+ * poll() timeout in ms until the first batched FIFO is due, -1 if none.
+ */
+int sensors_poll_context_t::batchTimeout(int64_t now) const
+{
+    int64_t next = -1;
+
+    for (int handle=0 ; handle<SENSORS_NUM_HANDLES ; handle++) {
+        SensorFifo* fifo = mFifos[handle];
+        if (!fifo || fifo->empty() || !mActiveLatency[handle])
+            continue;
+        int64_t due = fifo->oldest() + mActiveLatency[handle] - now;
+        if (due < 0)
+            due = 0;
+        if (next < 0 || due < next)
+            next = due;
+    }
+    if (next < 0)
+        return -1;
+    return int((next + 999999) / 1000000);
+}
+
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
     int nbEvents = 0;
-    int ret;
+    int n = 0;
 
-    ret = poll(mPollFds, numSensorDrivers, nbEvents ? 0 : -1);
-    if (ret < 0) {
-        ALOGE("poll() failed (%s)", strerror(errno));
-        return -errno;
-    }
+    for (;;) {
+        int64_t now = SensorBase::getTimestamp();
+
+        syncBatchConfig();
+
+        // drain events the drivers already hold before polling again
+        for (int i=0 ; count && i<numSensorDrivers ; i++) {
+            SensorBase* const sensor(mSensors[i]);
+            if ((mPollFds[i].revents & POLLIN) || sensor->hasPendingEvents()) {
+                int nb = sensor->readEvents(data, count);
+                if (nb < count) {
+                    // no more data for this sensor
+                    mPollFds[i].revents = 0;
+                }
+                uint64_t t0 = mProfiler ? mProfiler->start() : 0;
+                nb = routeBatched(data, nb, now);
+                if (mProfiler)
+                    mProfiler->stop(HUB_PROF_COPY, t0);
+                count -= nb;
+                nbEvents += nb;
+                data += nb;
+            }
+        }
+
+        if (count) {
+            uint64_t t0 = mProfiler ? mProfiler->start() : 0;
+            int nb = drainBatched(data, count, now);
+            if (mProfiler && nb)
+                mProfiler->stop(HUB_PROF_COPY, t0);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        if (!count)
+            break;
 
-    if(mPollFds[accelgyromag].revents & POLLIN) {
-        SensorBase* const sensor(mSensors[accelgyromag]);
-        int nb = sensor->readEvents(data, count);
-        count -= nb;
-        nbEvents += nb;
-        data += nb;
-        mPollFds[accelgyromag].revents = 0;
+        // we still have some room, so try to see if we can get
+        // some events immediately or just wait if we don't have
+        // anything to return
+        uint64_t t0 = mProfiler ? mProfiler->start() : 0;
+        n = poll(mPollFds, numFds, nbEvents ? 0 : batchTimeout(now));
+        if (mProfiler && n > 0)
+            mProfiler->stop(HUB_PROF_POLL, t0);
+        if (n < 0) {
+            ALOGE("poll() failed (%s)", strerror(errno));
+            return -errno;
+        }
+        if (mPollFds[wake].revents & POLLIN) {
+            char msg;
+            int result = read(mPollFds[wake].fd, &msg, 1);
+            ALOGE_IF(result<0, "error reading from wake pipe (%s)", strerror(errno));
+            ALOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
+            mPollFds[wake].revents = 0;
+        }
+        // with nothing new right now, return what we have; a timeout with
+        // nothing in hand means a batch is due and is drained next round
+        if (n == 0 && nbEvents)
+            break;
     }
 
     return nbEvents;
@@ -167,22 +441,42 @@ static int poll__poll(struct sensors_poll_device_t *dev,
     return ctx->pollEvents(data, count);
 }
 
+static int poll__batch(struct sensors_poll_device_1 *dev,
+        int handle, int flags, int64_t period_ns, int64_t timeout) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->batch(handle, flags, period_ns, timeout);
+}
+
+static int poll__flush(struct sensors_poll_device_1 *dev,
+        int handle) {
+    sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+    return ctx->flush(handle);
+}
+
 /*****************************************************************************/
 
 int init_nusensors(hw_module_t const* module, hw_device_t** device)
+{
+    return init_nusensors_backend(module, NULL, device);
+}
+
+int init_nusensors_backend(hw_module_t const* module, HubBackend* backend,
+        hw_device_t** device)
 {
     int status = -EINVAL;
 
-    sensors_poll_context_t *dev = new sensors_poll_context_t();
-    memset(&dev->device, 0, sizeof(sensors_poll_device_t));
+    sensors_poll_context_t *dev = new sensors_poll_context_t(module, backend);
+    memset(&dev->device, 0, sizeof(sensors_poll_device_1));
 
     dev->device.common.tag = HARDWARE_DEVICE_TAG;
-    dev->device.common.version  = 0;
+    dev->device.common.version  = SENSORS_DEVICE_API_VERSION_1_1;
     dev->device.common.module   = const_cast<hw_module_t*>(module);
     dev->device.common.close    = poll__close;
     dev->device.activate        = poll__activate;
     dev->device.setDelay        = poll__setDelay;
     dev->device.poll            = poll__poll;
+    dev->device.batch           = poll__batch;
+    dev->device.flush           = poll__flush;
 
     *device = &dev->device.common;
     status = 0;
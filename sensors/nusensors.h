@@ -33,6 +33,21 @@ __BEGIN_DECLS
 
 int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
+__END_DECLS
+
+#ifdef __cplusplus
+class HubBackend;
+
+/*
+ * Open the poll device over the given hub backend instead of the driver;
+ * the device takes ownership of it. For the host harnesses under bench/.
+ */
+int init_nusensors_backend(hw_module_t const* module, HubBackend* backend,
+        hw_device_t** device);
+#endif
+
+__BEGIN_DECLS
+
 /*****************************************************************************/
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -66,6 +81,8 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define ID_STEP_COUNTER  (23) /* Step counter */
 #define ID_UNCALIB_GYRO  (24) /* Uncalibrated Gyroscope */
 #define ID_UNCALIB_MAG   (25) /* Uncalibrated Magenetometer */
+
+#define SENSORS_NUM_HANDLES (ID_UNCALIB_MAG + 1)
 /*****************************************************************************/
 
 /*
@@ -77,6 +94,9 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define SENSORHUB_DEVICE_NAME       "/dev/msp430"
 #define SENSORHUB_AS_DATA_NAME      "/dev/msp430_as"
 
+// depth of the HAL-side batching FIFO of each batchable sensor
+#define SENSORS_FIFO_EVENTS         (300)
+
 // 1000 LSG = 1G
 #define LSG                         (1024.0f)
 
@@ -15,7 +15,10 @@
  * limitations under the License.
  */
 
+// the host benches build this file under their own tag
+#ifndef LOG_TAG
 #define LOG_TAG "sensorhub"
+#endif
 
 #include <cutils/log.h>
 
@@ -26,9 +29,12 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __ANDROID__
 #include <linux/android_alarm.h>
+#endif
 #include <linux/input.h>
 #include <linux/msp430.h>
 
@@ -39,6 +45,8 @@
 
 #include <hardware/mot_sensorhub_msp430.h>
 
+#include "sensorhub_io.h"
+
 /* paths to the driver fds */
 #define DRIVER_CONTROL_PATH "/dev/msp430"
 #define DRIVER_DATA_NAME "/dev/msp430_ms"
@@ -72,12 +80,34 @@ static uint16_t algo_bits[SENSORHUB_NUM_ALGOS] = {
 
 struct sensorhub_context_t {
     struct sensorhub_device_t device;
+    /* what a harness opened the device over, NULL on the driver */
+    struct sensorhub_io_t const* io;
     int control_fd;
     struct pollfd data_pollfd;
     uint16_t active_algos;
     uint32_t active_parts[SENSORHUB_NUM_ALGOS];
+    /* last accepted request of each active algo and movement durations,
+       replayed after a hub reset */
+    unsigned char* algo_req[SENSORHUB_NUM_ALGOS];
+    unsigned int motion_dur;
+    unsigned int zrmotion_dur;
 };
 
+/* the driver nodes, or what a harness opened the device over */
+static int hub_ioctl(struct sensorhub_context_t* context, unsigned int cmd, void* arg)
+{
+    if (context->io && context->io->ioctl)
+        return context->io->ioctl(context->io->cookie, cmd, arg);
+    return ioctl(context->control_fd, cmd, arg);
+}
+
+static ssize_t hub_read(struct sensorhub_context_t* context, void* buf, size_t len)
+{
+    if (context->io && context->io->read)
+        return context->io->read(context->io->cookie, buf, len);
+    return read(context->data_pollfd.fd, buf, len);
+}
+
 static int64_t get_wall_clock()
 {
     struct timeval time;
@@ -85,6 +115,7 @@ static int64_t get_wall_clock()
     return (int64_t)((time.tv_sec*(int64_t)1000) + (time.tv_usec/(int64_t)1000));
 }
 
+#ifdef __ANDROID__
 static int64_t get_elapsed_realtime()
 {
     struct timespec ts;
@@ -101,6 +132,17 @@ static int64_t get_elapsed_realtime()
         return (int64_t)((ts.tv_sec*(int64_t)1000) + (ts.tv_nsec/(int64_t)1000000));
     return -1;
 }
+#else
+// no /dev/alarm on a host, the boot clock is what it reports
+static int64_t get_elapsed_realtime()
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_BOOTTIME, &ts) < 0)
+        return -1;
+    return (int64_t)((ts.tv_sec*(int64_t)1000) + (ts.tv_nsec/(int64_t)1000000));
+}
+#endif
 
 static int sensorhub_enable(struct sensorhub_device_t* device, struct sensorhub_algo_t* algo)
 {
@@ -114,16 +156,18 @@ static int sensorhub_enable(struct sensorhub_device_t* device, struct sensorhub_
     case SENSORHUB_ALGO_MOVEMENT:
         if (algo->enable) {
             data = algo->parameter[0];
-            if (ioctl(context->control_fd, MSP430_IOCTL_SET_MOTION_DUR, &data) < 0) {
+            if (hub_ioctl(context, MSP430_IOCTL_SET_MOTION_DUR, &data) < 0) {
                 ALOGE("MSP430_IOCTL_SET_MOTION_DUR error (%s)", strerror(errno));
                 error = -errno;
             }
             data = algo->parameter[1];
-            if (ioctl(context->control_fd, MSP430_IOCTL_SET_ZRMOTION_DUR, &data) < 0) {
+            if (hub_ioctl(context, MSP430_IOCTL_SET_ZRMOTION_DUR, &data) < 0) {
                 ALOGE("MSP430_IOCTL_SET_ZRMOTION_DUR error (%s)", strerror(errno));
                 error = -errno;
             }
             data = context->active_algos | (M_MMOVEME | M_NOMMOVE);
+            context->motion_dur = algo->parameter[0];
+            context->zrmotion_dur = algo->parameter[1];
         } else {
             data = context->active_algos & ~(M_MMOVEME | M_NOMMOVE);
         }
@@ -131,7 +175,7 @@ static int sensorhub_enable(struct sensorhub_device_t* device, struct sensorhub_
     }
 
     if (!error) {
-        if (ioctl(context->control_fd, MSP430_IOCTL_SET_ALGOS, &data) < 0) {
+        if (hub_ioctl(context, MSP430_IOCTL_SET_ALGOS, &data) < 0) {
             ALOGE("MSP430_IOCTL_SET_ALGOS error (%s)", strerror(errno));
             error = -errno;
         }
@@ -201,14 +245,23 @@ static int sensorhub_algo_req(struct sensorhub_device_t* device, uint16_t algo,
         }
     }
 
-    if (ioctl(context->control_fd, MSP430_IOCTL_SET_ALGO_REQ, bytes) < 0) {
+    if (hub_ioctl(context, MSP430_IOCTL_SET_ALGO_REQ, bytes) < 0) {
         ALOGE("MSP430_IOCTL_SET_ALGO_REQ error (%s)", strerror(errno));
         error = -errno;
     } else {
         context->active_parts[algo] = active_parts;
+        if (algo < SENSORHUB_NUM_ALGOS) {
+            free(context->algo_req[algo]);
+            context->algo_req[algo] = NULL;
+            if (active_parts) {
+                context->algo_req[algo] = malloc(sizeof(bytes));
+                if (context->algo_req[algo])
+                    memcpy(context->algo_req[algo], bytes, sizeof(bytes));
+            }
+        }
 
         // ioctl set algos
-        if (ioctl(context->control_fd, MSP430_IOCTL_SET_ALGOS, &algos) < 0) {
+        if (hub_ioctl(context, MSP430_IOCTL_SET_ALGOS, &algos) < 0) {
             ALOGE("MSP430_IOCTL_SET_ALGOS error (%s)", strerror(errno));
             error = -errno;
         } else {
@@ -238,7 +291,7 @@ static int sensorhub_algo_query(struct sensorhub_device_t* device, uint16_t algo
 
     memcpy(bytes, &algo, sizeof(algo));
 
-    if (ioctl(context->control_fd, MSP430_IOCTL_GET_ALGO_EVT, bytes) < 0) {
+    if (hub_ioctl(context, MSP430_IOCTL_GET_ALGO_EVT, bytes) < 0) {
         ALOGE("MSP430_IOCTL_GET_ALGO_EVT error (%s)", strerror(errno));
         error = -errno;
     } else {
@@ -265,6 +318,47 @@ static int sensorhub_algo_query(struct sensorhub_device_t* device, uint16_t algo
     return error;
 }
 
+/*
+ * The hub comes back from a reset with no algos running: replay the
+ * movement durations, every active request and the algo mask.
+ */
+static void sensorhub_restore(struct sensorhub_context_t* context)
+{
+    struct timespec start, end;
+    unsigned int data;
+    int i, replayed = 0, error = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&g_lock);
+
+    if (context->active_algos & (M_MMOVEME | M_NOMMOVE)) {
+        data = context->motion_dur;
+        if (hub_ioctl(context, MSP430_IOCTL_SET_MOTION_DUR, &data) < 0)
+            error = -errno;
+        data = context->zrmotion_dur;
+        if (hub_ioctl(context, MSP430_IOCTL_SET_ZRMOTION_DUR, &data) < 0)
+            error = -errno;
+    }
+    for (i = 0; i < SENSORHUB_NUM_ALGOS; i++) {
+        if (!context->algo_req[i])
+            continue;
+        if (hub_ioctl(context, MSP430_IOCTL_SET_ALGO_REQ, context->algo_req[i]) < 0)
+            error = -errno;
+        replayed++;
+    }
+    data = context->active_algos;
+    if (data && hub_ioctl(context, MSP430_IOCTL_SET_ALGOS, &data) < 0)
+        error = -errno;
+
+    pthread_mutex_unlock(&g_lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ALOGE("sensorhub_restore(): %d algo reqs, algos 0x%x, %lld us (%s)",
+        replayed, context->active_algos,
+        (long long)(end.tv_sec - start.tv_sec) * 1000000 +
+            (end.tv_nsec - start.tv_nsec) / 1000,
+        strerror(-error));
+}
+
 static int sensorhub_poll(struct sensorhub_device_t* device, struct sensorhub_event_t* event)
 {
     struct sensorhub_context_t* context = (struct sensorhub_context_t*)device;
@@ -280,7 +374,9 @@ static int sensorhub_poll(struct sensorhub_device_t* device, struct sensorhub_ev
         return -errno;
     }
 
-    ret = read(context->data_pollfd.fd, &buff, sizeof(struct msp430_moto_sensor_data));
+    ret = hub_read(context, &buff, sizeof(struct msp430_moto_sensor_data));
+    if (ret < 0)
+        return errno == EAGAIN ? 0 : -errno;
     if (ret == 0)
         return 0;
 
@@ -336,6 +432,7 @@ static int sensorhub_poll(struct sensorhub_device_t* device, struct sensorhub_ev
             return 0;
             break;
         case DT_RESET:
+            sensorhub_restore(context);
             event->type = SENSORHUB_EVENT_RESET;
             event->time = get_wall_clock();
             break;
@@ -347,21 +444,26 @@ static int sensorhub_poll(struct sensorhub_device_t* device, struct sensorhub_ev
 static int sensorhub_close(struct hw_device_t* device)
 {
     struct sensorhub_context_t* context = (struct sensorhub_context_t*)device;
-    close(context->control_fd);
-    close(context->data_pollfd.fd);
+    int i;
+
+    if (!context->io) {
+        close(context->control_fd);
+        close(context->data_pollfd.fd);
+    }
+    for (i = 0; i < SENSORHUB_NUM_ALGOS; i++)
+        free(context->algo_req[i]);
     free(context);
     pthread_mutex_destroy(&g_lock);
     return 0;
 }
 
-static int sensorhub_open(const struct hw_module_t* module, char const* name, struct hw_device_t** device)
+static struct sensorhub_context_t* sensorhub_create(const struct hw_module_t* module)
 {
     struct sensorhub_context_t* context = calloc(1, sizeof(struct sensorhub_context_t));
-    int fd;
 
     if (!context) {
         ALOGE("%s: Couldn't allocate context.", __func__);
-        return -ENOMEM;
+        return NULL;
     }
 
     pthread_mutex_init(&g_lock, NULL);
@@ -374,6 +476,17 @@ static int sensorhub_open(const struct hw_module_t* module, char const* name, st
     context->device.algo_req = sensorhub_algo_req;
     context->device.algo_query = sensorhub_algo_query;
     context->device.poll = sensorhub_poll;
+    context->active_algos = 0;
+    return context;
+}
+
+static int sensorhub_open(const struct hw_module_t* module, char const* name, struct hw_device_t** device)
+{
+    struct sensorhub_context_t* context = sensorhub_create(module);
+    int fd;
+
+    if (!context)
+        return -ENOMEM;
 
     fd = open(DRIVER_CONTROL_PATH, O_RDWR);
     if (fd < 0) {
@@ -395,7 +508,22 @@ static int sensorhub_open(const struct hw_module_t* module, char const* name, st
     context->data_pollfd.fd = fd;
     context->data_pollfd.events = POLLIN;
 
-    context->active_algos = 0;
+    *device = (struct hw_device_t*)context;
+    return 0;
+}
+
+int sensorhub_open_io(const struct hw_module_t* module,
+        struct sensorhub_io_t const* io, struct hw_device_t** device)
+{
+    struct sensorhub_context_t* context = sensorhub_create(module);
+
+    if (!context)
+        return -ENOMEM;
+
+    context->io = io;
+    context->control_fd = io->control_fd;
+    context->data_pollfd.fd = io->fd;
+    context->data_pollfd.events = POLLIN;
 
     *device = (struct hw_device_t*)context;
     return 0;
@@ -405,7 +533,12 @@ static struct hw_module_methods_t sensorhub_module_methods = {
     .open = sensorhub_open,
 };
 
-struct hw_module_t HAL_MODULE_INFO_SYM = {
+// the host benches link this module next to sensors.c under another name
+#ifndef SENSORHUB_MODULE_SYM
+#define SENSORHUB_MODULE_SYM HAL_MODULE_INFO_SYM
+#endif
+
+struct hw_module_t SENSORHUB_MODULE_SYM = {
     .tag = HARDWARE_MODULE_TAG,
     .version_major = 3,
     .version_minor = 0,
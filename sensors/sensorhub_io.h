@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORHUB_IO_H
+#define ANDROID_SENSORHUB_IO_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <hardware/hardware.h>
+
+__BEGIN_DECLS
+
+/*****************************************************************************/
+
+/*
+ * Stands in for the hub's control and motion nodes under the sensorhub
+ * module, as HubBackend does under HubSensor: ioctl() replaces
+ * /dev/msp430, fd and read() /dev/msp430_ms. Both fail like the system
+ * calls, with -1 and errno set. fd must be pollable and readable whenever
+ * read() has msp430_moto_sensor_data records to return. A NULL ioctl() or
+ * read() leaves the system call on control_fd or fd, the driver's path.
+ */
+struct sensorhub_io_t {
+    void* cookie;
+    int (*ioctl)(void* cookie, unsigned int cmd, void* arg);
+    ssize_t (*read)(void* cookie, void* buf, size_t len);
+    int fd;
+    int control_fd;
+};
+
+/*
+ * Open the sensorhub device over io instead of the driver, for the host
+ * harnesses under bench/. io must outlive the device; close() leaves fd
+ * and control_fd open.
+ */
+int sensorhub_open_io(const struct hw_module_t* module,
+        struct sensorhub_io_t const* io, struct hw_device_t** device);
+
+/*****************************************************************************/
+
+__END_DECLS
+
+#endif  // ANDROID_SENSORHUB_IO_H
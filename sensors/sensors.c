@@ -20,6 +20,7 @@
 #include <float.h>
 
 #include "nusensors.h"
+#include "hub_sensors.h"
 
 /*****************************************************************************/
 
@@ -38,6 +39,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 9.81f/2048.0f,
 		.power = 0.25f,
 		.minDelay = 10000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_ACCELEROMETER,
 		.reserved = {}
 	},
@@ -51,6 +54,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 1.0f,
 		.power = 6.1f,
 		.minDelay = 20000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_GYROSCOPE,
 		.reserved = {}
 	},
@@ -63,6 +68,8 @@ static const struct sensor_t sSensorList[] = {
 		.maxRange = 125000.0f,
 		.resolution = 1.0f,
 		.minDelay = 20000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_PRESSURE,
 		.reserved = {}
 	},
@@ -76,6 +83,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 1.0f/10.0f,
 		.power = 6.8f,
 		.minDelay = 10000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_MAGNETIC_FIELD,
 		.reserved = {}
 	},
@@ -89,6 +98,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 1.0f/64.0f,
 		.power = 7.05f,
 		.minDelay = 10000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_ORIENTATION,
 		.reserved = {}
 	},
@@ -122,15 +133,34 @@ static const struct sensor_t sSensorList[] = {
 		.version = 1,
 		.handle = SENSORS_HANDLE_BASE+ID_LA,
 		.type = SENSOR_TYPE_LINEAR_ACCELERATION,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_LINEAR_ACCELERATION,
 		.reserved = {}
 	},
+	{
+		.name = "MSP430 Rotation Vector",
+		.vendor = "Motorola",
+		.version = 1,
+		.handle = SENSORS_HANDLE_BASE+ID_Q,
+		.type = SENSOR_TYPE_ROTATION_VECTOR,
+		.maxRange = 1.0f,
+		.resolution = 1.0f/16384.0f,
+		.power = 7.05f,
+		.minDelay = 10000,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
+		.stringType = SENSOR_STRING_TYPE_ROTATION_VECTOR,
+		.reserved = {}
+	},
 	{
 		.name = "Gravity",
 		.vendor = "Motorola",
 		.version = 1,
 		.handle = SENSORS_HANDLE_BASE+ID_GR,
 		.type = SENSOR_TYPE_GRAVITY,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_GRAVITY,
 		.reserved = {}
 	},
@@ -266,6 +296,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 0.0f,
 		.power = 0.0f,
 		.minDelay = 0,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_STEP_DETECTOR,
 		.reserved = {}
 	},
@@ -279,6 +311,8 @@ static const struct sensor_t sSensorList[] = {
 		.resolution = 0.0f,
 		.power = 0.0f,
 		.minDelay = 0,
+		.fifoReservedEventCount = SENSORS_FIFO_EVENTS,
+		.fifoMaxEventCount = SENSORS_FIFO_EVENTS,
 		.stringType = SENSOR_STRING_TYPE_STEP_COUNTER,
 		.reserved = {}
 	},
@@ -305,6 +339,9 @@ static const struct sensor_t sSensorList[] = {
                 SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED, 2000.0f, 1.0f/10.0f, 6.8f, 10000, 0, 0, { 0 } },
 */
 
+// every handle hub_sensors.h flags as listed must have its entry above
+typedef char sensor_list_matches_hub_sensors[
+        ARRAY_SIZE(sSensorList) == HUB_NUM_LISTED ? 1 : -1];
 
 static int open_sensors(const struct hw_module_t* module, const char* name,
         struct hw_device_t** device);